@@ -54,6 +54,7 @@ int main(int argc, char** argv)
 #define RAID_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <pthread.h>
 #include <msgpack.h>
 
@@ -63,11 +64,15 @@ extern "C" {
 
 #define RAID_READER_MAX_DEPTH 64
 
+// Pass as a deadline to wait without one.
+#define RAID_NO_DEADLINE (-1)
+
 typedef int64_t raid_int_t;
 typedef double raid_float_t;
 
 struct raid_client;
 struct raid_request_group_entry;
+struct raid_map_index;
 
 typedef enum {
     RAID_SUCCESS,
@@ -100,33 +105,123 @@ typedef enum {
     RAID_CALLBACK_BEFORE_SEND,
     RAID_CALLBACK_AFTER_RECV,
     RAID_CALLBACK_MSG_RECV,
+    RAID_CALLBACK_RECONNECT,
+    RAID_CALLBACK_NUM_TYPES,
 } raid_callback_type_t;
 
+// Room for any socket address, like struct sockaddr_storage.
+#define RAID_ADDRESS_MAX_LEN 128
+
+/**
+ * A resolved socket address, see @ref raid_set_addresses.
+ */
+typedef struct raid_address {
+    int family; // AF_INET, AF_INET6...
+    size_t len; // length of the struct sockaddr in data
+    unsigned char data[RAID_ADDRESS_MAX_LEN];
+} raid_address_t;
+
+/**
+ * Socket tuning, see @ref raid_socket_options_init for the defaults.
+ *
+ * Options the platform doesn't support are ignored.
+ */
+typedef struct raid_socket_options {
+    int64_t connect_timeout_ms; // 0 waits as long as the OS does
+    int64_t recv_timeout_ms; // SO_RCVTIMEO, also how often pending requests are checked for timeouts
+    size_t zerocopy_threshold; // binary references from this size are sent zero-copy, 0 disables it
+    bool nodelay; // TCP_NODELAY, send small requests right away
+    bool quickack; // TCP_QUICKACK, re-armed after every recv
+    int send_buffer_size; // SO_SNDBUF, 0 keeps the OS default
+    int recv_buffer_size; // SO_RCVBUF, 0 keeps the OS default
+    bool keepalive; // SO_KEEPALIVE, to notice dead peers without traffic
+    int keepalive_idle_secs; // TCP_KEEPIDLE, 0 keeps the OS default
+    int keepalive_interval_secs; // TCP_KEEPINTVL, 0 keeps the OS default
+    int keepalive_count; // TCP_KEEPCNT, 0 keeps the OS default
+    int busy_poll_usecs; // SO_BUSY_POLL, 0 disables it
+    int user_timeout_ms; // TCP_USER_TIMEOUT, 0 keeps the OS default
+} raid_socket_options_t;
+
 typedef struct raid_socket {
     int handle;
+    int family; // address family of the handle
+    raid_socket_options_t opts;
+    bool zerocopy; // SO_ZEROCOPY enabled on the handle
+    uint32_t zerocopy_sent; // zero-copy sends issued
+    uint32_t zerocopy_done; // zero-copy sends completed
+    struct raid_shm* shm; // shared-memory rings when connected to a "shm:" host
+    unsigned int shm_readers; // receivers looking at the rings
 } raid_socket_t;
 
 typedef struct raid_reader {
     char* src_data; // owns
     size_t src_data_len;
+    size_t src_data_cap;
+    bool src_data_mapped; // src_data is a read-only file mapping, see raid_set_spill_threshold
     msgpack_zone* mempool; // owns
     msgpack_object* obj; // owns
     msgpack_object* etag_obj;
+    msgpack_object* action_obj;
     msgpack_object* header;
     msgpack_object* body;
     msgpack_object* nested;
     msgpack_object* parents[RAID_READER_MAX_DEPTH];
     int indices[RAID_READER_MAX_DEPTH];
     int nested_top;
+    struct raid_map_index* map_indices; // lives in mempool
 } raid_reader_t;
 
+/**
+ * Callback called when the writer no longer needs data passed to @ref raid_write_binary_ref.
+ */
+typedef void(*raid_release_callback_t)(const char*, size_t, void*);
+
+typedef struct raid_writer_ref {
+    size_t offset; // where the data goes in sbuf
+    const char* data;
+    size_t len;
+    raid_release_callback_t release;
+    void* user_data;
+} raid_writer_ref_t;
+
 typedef struct raid_writer {
     msgpack_sbuffer sbuf;
     msgpack_packer pk;
     char* etag;
     struct raid_client* cl;
+    raid_writer_ref_t* refs;
+    size_t num_refs;
+    size_t refs_cap;
+    size_t refs_len;
+    bool idempotent; // the message's action can be replayed after reconnecting
 } raid_writer_t;
 
+typedef struct raid_format_item {
+    size_t prefix_len;
+    char type;
+} raid_format_item_t;
+
+/**
+ * A compiled format string for @ref raid_write_format, see @ref raid_format_compile.
+ */
+typedef struct raid_format {
+    bool is_map;
+    char* prefix; // pre-encoded container header and keys
+    size_t prefix_len;
+    raid_format_item_t* items;
+    size_t num_items;
+} raid_format_t;
+
+/**
+ * A pre-encoded message envelope for an action, see @ref raid_action_new.
+ */
+typedef struct raid_action {
+    char* name;
+    char* envelope;
+    size_t envelope_len;
+    size_t etag_offset;
+} raid_action_t;
+
 typedef enum raid_state {
     RAID_STATE_WAIT_MESSAGE,
     RAID_STATE_PROCESSING_MESSAGE,
@@ -153,15 +248,24 @@ typedef void(*raid_after_recv_callback_t)(struct raid_client*, const char*, size
  */
 typedef void(*raid_msg_recv_callback_t)(struct raid_client*, raid_reader_t*, void*);
 
+/**
+ * Callback called after the client reconnected on its own.
+ */
+typedef void(*raid_reconnect_callback_t)(struct raid_client*, void*);
+
 /**
  * A Raid request.
  */
 typedef struct raid_request {
     int64_t created_at;
     int64_t timeout_secs;
+    int64_t deadline_ms; // on raid_clock_ms, or RAID_NO_DEADLINE
     char* etag;
     raid_response_callback_t callback;
     void* callback_user_data;
+    struct raid_request** handle; // cleared when the request is removed
+    char* replay; // copy of the frame to send again after reconnecting
+    size_t replay_len;
     struct raid_request* next;
     struct raid_request* prev;
 } raid_request_t;
@@ -205,9 +309,15 @@ typedef struct raid_request_group
     struct raid_client* raid;
     size_t num_entries;
     size_t num_entries_done;
+    size_t num_entries_sent; // entries in the last send, the rest can't be pending
     pthread_cond_t entries_cond;
     pthread_mutex_t entries_mutex;
-    struct raid_request_group_entry* entries;
+    struct raid_request_group_entry* entries; // contiguous, entries_cap long
+    size_t entries_cap;
+    size_t* ready; // indices of done entries in arrival order, num_entries_done long
+    size_t ready_pos; // next ready entry to hand out
+    int64_t deadline_ms; // on raid_clock_ms, or RAID_NO_DEADLINE
+    bool deadline_expired;
 } raid_request_group_t;
 
 /**
@@ -215,13 +325,12 @@ typedef struct raid_request_group
  */
 typedef struct raid_request_group_entry
 {
-    struct raid_request_group_entry* prev;
-    struct raid_request_group_entry* next;
     raid_writer_t writer;
     raid_reader_t reader;
     raid_response_callback_t response_callback;
     raid_error_t error;
     raid_request_group_t* group;
+    struct raid_request* request; // pending request, guarded by the client's reqs_mutex
     void* user_data;
 } raid_request_group_entry_t;
 
@@ -232,11 +341,38 @@ typedef struct raid_callback {
         raid_before_send_callback_t before_send;
         raid_after_recv_callback_t after_recv;
         raid_msg_recv_callback_t msg_recv;
+        raid_reconnect_callback_t reconnect;
     } callback;
-    struct raid_callback* next;
-    struct raid_callback* prev;
 } raid_callback_t;
 
+typedef struct raid_subscription {
+    const char* action; // points into the table
+    size_t action_len;
+    uint32_t hash;
+    raid_msg_recv_callback_t callback;
+    void* user_data;
+} raid_subscription_t;
+
+/**
+ * An immutable hash table of subscriptions by action, replaced as a whole on every change.
+ */
+typedef struct raid_subscription_table {
+    struct raid_subscription_table* next_retired;
+    size_t num_subscriptions;
+    size_t num_buckets; // power of two
+    size_t* buckets; // bucket i holds subscriptions[buckets[i]] up to subscriptions[buckets[i + 1]]
+    raid_subscription_t* subscriptions;
+} raid_subscription_table_t;
+
+/**
+ * An immutable snapshot of the callbacks of one type, replaced as a whole on every change.
+ */
+typedef struct raid_callback_list {
+    struct raid_callback_list* next_retired;
+    size_t num_callbacks;
+    raid_callback_t callbacks[];
+} raid_callback_list_t;
+
 /**
  * The client state holding sockets, requests, etc...
  */
@@ -245,17 +381,43 @@ typedef struct raid_client {
     raid_socket_t socket;
     char* host;
     char* port;
+    raid_address_t* addresses; // pre-resolved, used instead of the host
+    size_t num_addresses;
     const char* in_ptr;
     const char* in_end;
+    char msg_header[4];
+    size_t msg_header_len;
     char* msg_buf;
+    size_t msg_buf_cap;
+    FILE* msg_spill; // frames over spill_threshold are received here instead of msg_buf
     size_t msg_total_size;
     size_t msg_len;
+    size_t max_frame_size;
+    size_t spill_threshold;
     size_t etag_gen_cnt;
     size_t num_requests;
     int64_t request_timeout_secs;
     raid_state_t state;
     raid_request_t* reqs;
-    raid_callback_t* callbacks;
+    raid_callback_list_t* callbacks[RAID_CALLBACK_NUM_TYPES]; // NULL when there are none
+    raid_callback_list_t* retired_callbacks; // replaced lists readers might still be walking
+    raid_subscription_table_t* subscriptions; // NULL when there are none
+    raid_subscription_table_t* retired_subscriptions;
+    unsigned int callback_readers;
+    pthread_mutex_t callbacks_mutex; // serializes changes, dispatch doesn't take it
+    bool auto_reconnect;
+    bool closing; // disconnecting on purpose, don't reconnect
+    int64_t reconnect_min_ms;
+    int64_t reconnect_max_ms;
+    uint32_t reconnect_seed;
+    pthread_cond_t reconnect_cond;
+    char** idempotent_actions;
+    size_t num_idempotent_actions;
+    raid_reader_t* reader_pool;
+    size_t reader_pool_len;
+    raid_writer_t** writer_pool;
+    size_t writer_pool_len;
+    pthread_mutex_t pool_mutex;
     pthread_mutex_t reqs_mutex;
     pthread_t recv_thread;
     bool recv_thread_active;
@@ -264,13 +426,40 @@ typedef struct raid_client {
 /**
  * @brief Configure the client's host and port.
  *
+ * A host like "unix:/path/to/socket" connects to a unix domain socket
+ * instead, on platforms that have them. On Linux, "shm:/path/to/socket"
+ * also connects through that unix socket, but only to hand the peer a pair
+ * of shared-memory rings the messages go through afterwards.
+ *
  * @param cl Raid client instance.
- * @param host Hostname to connect.
- * @param port Port to connect in the host.
+ * @param host Hostname to connect, or "unix:" or "shm:" followed by a socket path.
+ * @param port Port to connect in the host, may be NULL for the other two.
  * @return Any errors that might occur.
  */
 raid_error_t raid_init(raid_client_t* cl, const char* host, const char* port);
 
+/**
+ * @brief Configure the client's host, port and socket options.
+ *
+ * @param cl Raid client instance.
+ * @param host Hostname to connect, or "unix:" or "shm:" followed by a socket path.
+ * @param port Port to connect in the host, may be NULL for the other two.
+ * @param opts Socket options, copied by the client, or NULL for the defaults.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_init_ex(raid_client_t* cl, const char* host, const char* port, const raid_socket_options_t* opts);
+
+/**
+ * @brief Fill the socket options with the defaults, tuned for low latency.
+ *
+ * Nagle's algorithm is disabled and delayed ACKs are avoided, keepalive
+ * probes start after 30 seconds idle, every 10 seconds, giving up after 3.
+ * Connecting times out after 10 seconds and so does receiving.
+ *
+ * @param opts The socket options.
+ */
+void raid_socket_options_init(raid_socket_options_t* opts);
+
 /**
  * @brief Connect to the client's host and port.
  *
@@ -326,6 +515,111 @@ void raid_add_after_recv_callback(raid_client_t* cl, raid_after_recv_callback_t
  */
 void raid_add_msg_recv_callback(raid_client_t* cl, raid_msg_recv_callback_t cb, void* user_data);
 
+/**
+ * @brief Adds a "reconnect" callback, which gets called after the client
+ * reconnected on its own, see @ref raid_set_auto_reconnect.
+ *
+ * @param cl Raid client instance.
+ * @param cb Callback to be called.
+ * @param user_data Callback user data.
+ */
+void raid_add_reconnect_callback(raid_client_t* cl, raid_reconnect_callback_t cb, void* user_data);
+
+/**
+ * @brief Subscribes to the messages the server sends on its own with the given action.
+ *
+ * The messages are routed by action with a single lookup, and still reach
+ * the "msg_recv" callbacks afterwards. Many callbacks can subscribe to the same action.
+ *
+ * @param cl Raid client instance.
+ * @param action The action name.
+ * @param cb Callback to be called.
+ * @param user_data Callback user data.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_subscribe(raid_client_t* cl, const char* action, raid_msg_recv_callback_t cb, void* user_data);
+
+/**
+ * @brief Removes a subscription made with the same action, callback and user data.
+ *
+ * @param cl Raid client instance.
+ * @param action The action name.
+ * @param cb Callback to remove.
+ * @param user_data Callback user data.
+ * @return Whether the subscription was found.
+ */
+bool raid_unsubscribe(raid_client_t* cl, const char* action, raid_msg_recv_callback_t cb, void* user_data);
+
+/**
+ * @brief Removes a "before_send" callback added with the same user data.
+ *
+ * Callbacks can be added and removed at any time, even from within a callback.
+ * A callback being removed may still be running on another thread.
+ *
+ * @param cl Raid client instance.
+ * @param cb Callback to remove.
+ * @param user_data Callback user data.
+ * @return Whether the callback was found.
+ */
+bool raid_remove_before_send_callback(raid_client_t* cl, raid_before_send_callback_t cb, void* user_data);
+
+/**
+ * @brief Removes an "after_recv" callback added with the same user data.
+ *
+ * @param cl Raid client instance.
+ * @param cb Callback to remove.
+ * @param user_data Callback user data.
+ * @return Whether the callback was found.
+ */
+bool raid_remove_after_recv_callback(raid_client_t* cl, raid_after_recv_callback_t cb, void* user_data);
+
+/**
+ * @brief Removes a "msg_recv" callback added with the same user data.
+ *
+ * @param cl Raid client instance.
+ * @param cb Callback to remove.
+ * @param user_data Callback user data.
+ * @return Whether the callback was found.
+ */
+bool raid_remove_msg_recv_callback(raid_client_t* cl, raid_msg_recv_callback_t cb, void* user_data);
+
+/**
+ * @brief Removes a "reconnect" callback added with the same user data.
+ *
+ * @param cl Raid client instance.
+ * @param cb Callback to remove.
+ * @param user_data Callback user data.
+ * @return Whether the callback was found.
+ */
+bool raid_remove_reconnect_callback(raid_client_t* cl, raid_reconnect_callback_t cb, void* user_data);
+
+/**
+ * @brief Reconnect on its own when the connection drops.
+ *
+ * Attempts are spaced by an exponential backoff with jitter, between the minimum and
+ * maximum delays, until one succeeds or the client is disconnected. Pending requests
+ * for idempotent actions are sent again on the new connection, the others fail
+ * with RAID_NOT_CONNECTED.
+ *
+ * @param cl Raid client instance.
+ * @param enabled Whether to reconnect.
+ * @param min_delay_ms Delay before the second attempt, the first one is immediate.
+ * @param max_delay_ms Maximum delay between attempts.
+ */
+void raid_set_auto_reconnect(raid_client_t* cl, bool enabled, int64_t min_delay_ms, int64_t max_delay_ms);
+
+/**
+ * @brief Mark an action as safe to send twice, so its pending requests are
+ * replayed after an automatic reconnect.
+ *
+ * Only affects messages written after the call.
+ *
+ * @param cl Raid client instance.
+ * @param action The action name.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_register_idempotent_action(raid_client_t* cl, const char* action);
+
 /**
  * @brief Set the amount of seconds a request is considered timed out.
  *
@@ -334,6 +628,102 @@ void raid_add_msg_recv_callback(raid_client_t* cl, raid_msg_recv_callback_t cb,
  */
 void raid_set_request_timeout(raid_client_t* cl, int64_t timeout_secs);
 
+/**
+ * @brief Set the largest frame accepted from the server.
+ *
+ * A frame over the limit drops the connection, since the rest of the stream
+ * can't be trusted. Memory for a frame grows as its data arrives, so a bogus
+ * length doesn't allocate the whole size up front.
+ *
+ * @param cl Raid client instance.
+ * @param max_size Size in bytes, 0 restores the default of 1GB.
+ */
+void raid_set_max_frame_size(raid_client_t* cl, size_t max_size);
+
+/**
+ * @brief Set the frame size from which responses are received into a temporary file.
+ *
+ * Keeps slow or huge responses from holding memory while they arrive. Once complete
+ * the file is mapped read-only and decoded in place, so strings and binaries in the
+ * response are paged in from the file as they're read instead of living in memory.
+ * Where mapping isn't available the frame is loaded into memory instead.
+ *
+ * @param cl Raid client instance.
+ * @param threshold Size in bytes, 0 disables spilling (the default).
+ */
+void raid_set_spill_threshold(raid_client_t* cl, size_t threshold);
+
+/**
+ * @brief Set the size from which binary references are sent with MSG_ZEROCOPY.
+ *
+ * Only has effect on Linux, and only on data given to @ref raid_write_binary_ref.
+ * The length prefix and the writer's own buffer are always copied, so the
+ * writer can be reused or destroyed as soon as the request call returns.
+ *
+ * The send returns without waiting for the kernel to release referenced
+ * pages, it may read them again until then, e.g. to retransmit. Referenced
+ * data must stay valid and unmodified until @ref raid_zerocopy_pending returns
+ * zero, even after the reference's release callback ran or the response
+ * arrived.
+ *
+ * @param cl Raid client instance.
+ * @param threshold Size in bytes, 0 disables zero-copy sends (the default).
+ */
+void raid_set_zerocopy_threshold(raid_client_t* cl, size_t threshold);
+
+/**
+ * @brief Get how many zero-copy sends the kernel didn't release yet, never blocks.
+ *
+ * @param cl Raid client instance.
+ * @return Number of sends still holding on to their pages.
+ */
+size_t raid_zerocopy_pending(raid_client_t* cl);
+
+/**
+ * @brief Set how long connecting may take, across every address the host resolves to.
+ *
+ * @param cl Raid client instance.
+ * @param timeout_ms Timeout in milliseconds, 0 waits as long as the OS does.
+ */
+void raid_set_connect_timeout(raid_client_t* cl, int64_t timeout_ms);
+
+/**
+ * @brief Connect to these addresses instead of resolving the client's host.
+ *
+ * Meant for callers that resolve on their own, or share one resolution
+ * among many clients. Affects the next connect or reconnect.
+ *
+ * @param cl Raid client instance.
+ * @param addrs The addresses, in the order to try them, copied by the client.
+ * @param num_addrs Number of addresses, 0 goes back to resolving the host.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_set_addresses(raid_client_t* cl, const raid_address_t* addrs, size_t num_addrs);
+
+/**
+ * @brief Resolve the client's host in the background, so the next connect
+ * finds its addresses in the cache.
+ *
+ * @param cl Raid client instance.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_resolve_async(raid_client_t* cl);
+
+/**
+ * @brief Set for how long resolved addresses are reused, for every client in the process.
+ *
+ * Clients connecting to the same host share the cached addresses, and
+ * concurrent lookups for a host wait on the one already running.
+ *
+ * @param ttl_ms Time in milliseconds, 0 disables the cache. Defaults to 60 seconds.
+ */
+void raid_set_address_cache_ttl(int64_t ttl_ms);
+
+/**
+ * @brief Forget every cached address, so the next connects resolve their hosts again.
+ */
+void raid_clear_address_cache();
+
 /**
  * @brief Return the number of pending requests from this client.
  *
@@ -342,6 +732,13 @@ void raid_set_request_timeout(raid_client_t* cl, int64_t timeout_secs);
  */
 size_t raid_num_requests(raid_client_t* cl);
 
+/**
+ * @brief Return a monotonic clock in milliseconds, to build deadlines from.
+ *
+ * @return Milliseconds since an unspecified point in time.
+ */
+int64_t raid_clock_ms();
+
 /**
  * @brief Send a request to the raid server.
  *
@@ -353,6 +750,23 @@ size_t raid_num_requests(raid_client_t* cl);
  */
 raid_error_t raid_request_async(raid_client_t* cl, const raid_writer_t* w, raid_response_callback_t cb, void* user_data);
 
+/**
+ * @brief Send a request to the raid server, failing it with RAID_RECV_TIMEOUT
+ * if there's no response by the deadline.
+ *
+ * The deadline is checked by the receive thread whenever data arrives or the
+ * socket's recv_timeout_ms passes, so on a quiet connection the request can
+ * fail up to recv_timeout_ms after the deadline.
+ *
+ * @param cl Raid client instance.
+ * @param w Request writer.
+ * @param deadline_ms Deadline on @ref raid_clock_ms, or RAID_NO_DEADLINE.
+ * @param cb Response callback.
+ * @param user_data Callback user data.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_request_async_until(raid_client_t* cl, const raid_writer_t* w, int64_t deadline_ms, raid_response_callback_t cb, void* user_data);
+
 /**
  * @brief Send a request to the raid server and block until response is received.
  *
@@ -420,6 +834,13 @@ void raid_reader_init_with_data(raid_reader_t* r, const char* data, size_t data_
  */
 void raid_reader_destroy(raid_reader_t* r);
 
+/**
+ * @brief Clear the reader's data, keeping its allocated memory to be reused by the next message.
+ *
+ * @param r Reader instance.
+ */
+void raid_reader_reset(raid_reader_t* r);
+
 /**
  * @brief Swap the contents of two readers.
  *
@@ -522,6 +943,32 @@ bool raid_is_code(raid_reader_t* r, const char* code);
  */
 bool raid_read_code(raid_reader_t* r, char** res, size_t* len);
 
+/**
+ * @brief Reads the code from the response message without copying it.
+ *
+ * The string is not null-terminated and points into the reader's buffer,
+ * it stays valid until the reader receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param res Pointer to receive the code string.
+ * @param len Pointer to receive the length of the string.
+ * @return Whether the code could be read or not.
+ */
+bool raid_read_code_view(raid_reader_t* r, const char** res, size_t* len);
+
+/**
+ * @brief Reads the action from the message header without copying it.
+ *
+ * The string is not null-terminated and points into the reader's buffer,
+ * it stays valid until the reader receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param res Pointer to receive the action string.
+ * @param len Pointer to receive the length of the string.
+ * @return Whether the action could be read or not.
+ */
+bool raid_read_action_view(raid_reader_t* r, const char** res, size_t* len);
+
 /**
  * @brief Reads the null-terminated code from the response message, the caller owns the string.
  *
@@ -540,6 +987,19 @@ bool raid_read_code_cstring(raid_reader_t* r, char** res);
  */
 bool raid_read_etag_cstring(raid_reader_t* r, char** res);
 
+/**
+ * @brief Reads the etag from the response message without copying it.
+ *
+ * The string is not null-terminated and points into the reader's buffer,
+ * it stays valid until the reader receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param res Pointer to receive the etag string.
+ * @param len Pointer to receive the length of the string.
+ * @return Whether the etag could be read or not.
+ */
+bool raid_read_etag_view(raid_reader_t* r, const char** res, size_t* len);
+
 /**
  * @brief Returns the type of the current value in the response message body.
  *
@@ -575,6 +1035,28 @@ bool raid_read_int(raid_reader_t* r, int64_t* res);
  */
 bool raid_read_float(raid_reader_t* r, double* res);
 
+/**
+ * @brief Reads an array of integers from the response message body in one call.
+ *
+ * @param r Raid client instance.
+ * @param out Buffer to receive the values.
+ * @param n Maximum number of values to copy into @p out.
+ * @param len Pointer to receive the length of the array, which can be bigger than @p n.
+ * @return Whether the value is an array of integers or not.
+ */
+bool raid_read_int_array(raid_reader_t* r, int64_t* out, size_t n, size_t* len);
+
+/**
+ * @brief Reads an array of floats from the response message body in one call.
+ *
+ * @param r Raid client instance.
+ * @param out Buffer to receive the values.
+ * @param n Maximum number of values to copy into @p out.
+ * @param len Pointer to receive the length of the array, which can be bigger than @p n.
+ * @return Whether the value is an array of floats or not.
+ */
+bool raid_read_float_array(raid_reader_t* r, double* out, size_t n, size_t* len);
+
 /**
  * @brief Reads a binary array from the response message body.
  *
@@ -585,6 +1067,19 @@ bool raid_read_float(raid_reader_t* r, double* res);
  */
 bool raid_read_binary(raid_reader_t* r, char** res, size_t* len);
 
+/**
+ * @brief Reads a binary array from the response message body without copying it.
+ *
+ * The data points into the reader's buffer, it stays valid until the reader
+ * receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param res Pointer to receive data.
+ * @param len Pointer to receive the length of the array.
+ * @return Whether the value could be read or not.
+ */
+bool raid_read_binary_view(raid_reader_t* r, const char** res, size_t* len);
+
 /**
  * @brief Reads a string from the response message body.
  *
@@ -595,6 +1090,19 @@ bool raid_read_binary(raid_reader_t* r, char** res, size_t* len);
  */
 bool raid_read_string(raid_reader_t* r, char** res, size_t* len);
 
+/**
+ * @brief Reads a string from the response message body without copying it.
+ *
+ * The string is not null-terminated and points into the reader's buffer,
+ * it stays valid until the reader receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param res Pointer to receive string value.
+ * @param len Pointer to receive the length of the string.
+ * @return Whether the value could be read or not.
+ */
+bool raid_read_string_view(raid_reader_t* r, const char** res, size_t* len);
+
 /**
  * @brief Reads a string from the response message body and null-terminates it.
  *
@@ -624,6 +1132,19 @@ bool raid_copy_cstring(raid_reader_t* r, char* buf, size_t buf_len);
  */
 bool raid_read_map_key(raid_reader_t* r, char** key, size_t* len);
 
+/**
+ * @brief Reads the current map key without copying it.
+ *
+ * The string is not null-terminated and points into the reader's buffer,
+ * it stays valid until the reader receives new data or is destroyed.
+ *
+ * @param r Raid client instance.
+ * @param key Pointer to receive string value.
+ * @param len Pointer to receive the length of the string.
+ * @return Whether the value could be read or not.
+ */
+bool raid_read_map_key_view(raid_reader_t* r, const char** key, size_t* len);
+
 /**
  * @brief Reads the current map key null-terminated version.
  *
@@ -683,6 +1204,41 @@ void raid_read_end_map(raid_reader_t* r);
  */
 bool raid_read_next(raid_reader_t* r);
 
+/**
+ * @brief Enters the current map and moves to the value of the given key.
+ *
+ * Big maps are indexed by a hash table on the first lookup, so looking up many
+ * keys in the same map does not scan it every time. Call @ref raid_read_end_map
+ * to go back to the map.
+ *
+ * @param r Raid client instance.
+ * @param key Null-terminated key to look for.
+ * @return Whether the key was found or not.
+ */
+bool raid_read_map_get(raid_reader_t* r, const char* key);
+
+/**
+ * @brief Moves to the value at the given path, relative to the current value, e.g.:
+ * @c raid_read_path(r, "items.3.id") reads the key "id" of the fourth element of "items".
+ *
+ * Components are separated by dots, numeric components index arrays. If the path
+ * can't be followed the reader position is left untouched. Call @ref raid_read_end_path
+ * with the same path to go back.
+ *
+ * @param r Raid client instance.
+ * @param path Path to follow.
+ * @return Whether the path was found or not.
+ */
+bool raid_read_path(raid_reader_t* r, const char* path);
+
+/**
+ * @brief Goes back to the value where @ref raid_read_path was called.
+ *
+ * @param r Raid client instance.
+ * @param path The same path given to @ref raid_read_path.
+ */
+void raid_read_end_path(raid_reader_t* r, const char* path);
+
 /**
  * @brief Initialize the writer state.
  *
@@ -712,6 +1268,31 @@ raid_writer_t* raid_writer_new(raid_client_t* cl);
  */
 void raid_writer_delete(raid_writer_t* w);
 
+/**
+ * @brief Get a writer from the client's pool of idle writers, or allocate a new one
+ * if the pool is empty. Pooled writers keep their buffer capacity from previous messages.
+ *
+ * @param cl Client instance.
+ * @return Pointer to the writer, give it back with @ref raid_writer_release.
+ */
+raid_writer_t* raid_writer_acquire(raid_client_t* cl);
+
+/**
+ * @brief Give a writer back to its client's pool, pointer is no longer valid.
+ *
+ * @param w Writer instance returned by @ref raid_writer_acquire.
+ */
+void raid_writer_release(raid_writer_t* w);
+
+/**
+ * @brief Make sure at least @p len more bytes can be written without growing the buffer.
+ *
+ * @param w Writer instance.
+ * @param len Number of bytes to reserve.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_writer_reserve(raid_writer_t* w, size_t len);
+
 /**
  * @brief Begin writing a request message to send to the server.
  *
@@ -730,6 +1311,58 @@ raid_error_t raid_write_message(raid_writer_t* w, const char* action);
  */
 raid_error_t raid_write_message_without_body(raid_writer_t* w, const char* action);
 
+/**
+ * @brief Pre-encode the message envelope (header and body key) of an action into @p a.
+ *
+ * @param a Action instance.
+ * @param name Action name.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_action_init(raid_action_t* a, const char* name);
+
+/**
+ * @brief Destroy an action.
+ *
+ * @param a Action instance.
+ */
+void raid_action_destroy(raid_action_t* a);
+
+/**
+ * @brief Allocate an action and pre-encode its message envelope, to be used with
+ * @ref raid_write_message_action when the same action is sent many times.
+ *
+ * @param name Action name.
+ * @return Pointer to the action, or NULL if the name is invalid.
+ */
+raid_action_t* raid_action_new(const char* name);
+
+/**
+ * @brief Destroy and deallocate an action, pointer is no longer valid.
+ *
+ * @param a Action instance.
+ */
+void raid_action_delete(raid_action_t* a);
+
+/**
+ * @brief Begin writing a request message from a pre-encoded action, same
+ * as @ref raid_write_message without encoding the header every time.
+ *
+ * @param w Raid writer instance.
+ * @param action Action of the message.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_message_action(raid_writer_t* w, const raid_action_t* action);
+
+/**
+ * @brief Begin writing a request message without body from a pre-encoded action, same
+ * as @ref raid_write_message_without_body without encoding the header every time.
+ *
+ * @param w Raid writer instance.
+ * @param action Action of the message.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_message_action_without_body(raid_writer_t* w, const raid_action_t* action);
+
 /**
  * @brief Write a msgpack object in the request body.
  *
@@ -784,6 +1417,28 @@ raid_error_t raid_write_int(raid_writer_t* w, int64_t n);
  */
 raid_error_t raid_write_float(raid_writer_t* w, double n);
 
+/**
+ * @brief Write an array of integers in the request body, same as calling
+ * @ref raid_write_int for each element but without the per-element overhead.
+ *
+ * @param w Raid writer instance.
+ * @param data Integers to write.
+ * @param n Number of integers.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_int_array(raid_writer_t* w, const int64_t* data, size_t n);
+
+/**
+ * @brief Write an array of floats in the request body, same as calling
+ * @ref raid_write_float for each element but without the per-element overhead.
+ *
+ * @param w Raid writer instance.
+ * @param data Floats to write.
+ * @param n Number of floats.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_float_array(raid_writer_t* w, const double* data, size_t n);
+
 /**
  * @brief Write a binary array in the request body.
  *
@@ -794,6 +1449,22 @@ raid_error_t raid_write_float(raid_writer_t* w, double n);
  */
 raid_error_t raid_write_binary(raid_writer_t* w, const char* data, size_t len);
 
+/**
+ * @brief Write a binary array in the request body without copying it, the data
+ * is sent straight from @p data. Small arrays are copied anyway.
+ *
+ * The data must stay valid until @p release is called, which happens when the writer
+ * begins a new message, is flattened or is destroyed.
+ *
+ * @param w Raid writer instance.
+ * @param data Array data.
+ * @param len Array size.
+ * @param release Callback called when the writer is done with the data (optional).
+ * @param user_data Callback user data.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_binary_ref(raid_writer_t* w, const char* data, size_t len, raid_release_callback_t release, void* user_data);
+
 /**
  * @brief Write a string in the request body.
  *
@@ -855,6 +1526,51 @@ raid_error_t raid_write_arrayf(raid_writer_t* w, int n, const char* format, ...)
  */
 raid_error_t raid_write_mapf(raid_writer_t* w, int n, const char* format, ...);
 
+/**
+ * @brief Compile a format string into @p f, to be written later with @ref raid_write_format.
+ *
+ * @param f Format instance.
+ * @param format Format string, same syntax of @ref raid_write_mapf or @ref raid_write_arrayf.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_format_init(raid_format_t* f, const char* format);
+
+/**
+ * @brief Destroy a compiled format.
+ *
+ * @param f Format instance.
+ */
+void raid_format_destroy(raid_format_t* f);
+
+/**
+ * @brief Allocate and compile a format string, e.g.: @c raid_format_compile("'number' %d 'name' %s")
+ *
+ * Formats starting with a quoted key write a map, formats starting with '%' write an array.
+ * The keys and the container header are encoded only once, here.
+ *
+ * @param format Format string, same syntax of @ref raid_write_mapf or @ref raid_write_arrayf.
+ * @return Pointer to the compiled format, or NULL if the format is invalid.
+ */
+raid_format_t* raid_format_compile(const char* format);
+
+/**
+ * @brief Destroy and deallocate a compiled format, pointer is no longer valid.
+ *
+ * @param f Format instance.
+ */
+void raid_format_delete(raid_format_t* f);
+
+/**
+ * @brief Variadic function to write a map or array in the request body according to a
+ * compiled format, e.g.: @c raid_write_format(w, f, (int64_t)10, "string")
+ *
+ * @param w Raid writer instance.
+ * @param f Compiled format.
+ * @param ... Arguments to put in the map or array.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_write_format(raid_writer_t* w, const raid_format_t* f, ...);
+
 /**
  * @brief Get the etag of the request this writer contains. In other words, @ref raid_write_message must
  * have been previously called. If not, this function will return NULL.
@@ -867,6 +1583,9 @@ const char* raid_writer_etag(const raid_writer_t* w);
 /**
  * @brief Get a pointer to the writer's generated data.
  *
+ * Data written with @ref raid_write_binary_ref is not included until
+ * @ref raid_writer_flatten is called.
+ *
  * @param w Raid writer instance.
  * @return Pointer to the writer's generated data.
  */
@@ -875,11 +1594,23 @@ const char* raid_writer_data(const raid_writer_t* w);
 /**
  * @brief Get the size of the writer's generated data.
  *
+ * Matches @ref raid_writer_data, so data written with @ref raid_write_binary_ref
+ * is not counted until @ref raid_writer_flatten is called.
+ *
  * @param w Raid writer instance.
  * @return Size of the writer's generated data.
  */
 size_t raid_writer_size(const raid_writer_t* w);
 
+/**
+ * @brief Copy the data written with @ref raid_write_binary_ref into the writer's
+ * buffer, so @ref raid_writer_data returns the whole message.
+ *
+ * @param w Raid writer instance.
+ * @return Any errors that might occur.
+ */
+raid_error_t raid_writer_flatten(raid_writer_t* w);
+
 /**
  * @brief Initialize a request group.
  *
@@ -903,6 +1634,27 @@ void raid_request_group_destroy(raid_request_group_t* g);
  */
 raid_request_group_t* raid_request_group_new(raid_client_t* raid);
 
+/**
+ * @brief Allocate and initialize a request group with room for some entries.
+ *
+ * @param raid Raid client instance.
+ * @param capacity How many entries to allocate up front.
+ * @return The request group.
+ */
+raid_request_group_t* raid_request_group_new_with_capacity(raid_client_t* raid, size_t capacity);
+
+/**
+ * @brief Make room for at least this many entries in the group.
+ *
+ * Like adding entries, this invalidates pointers to existing entries.
+ * Fails while requests sent by the group are pending, they point at the entries.
+ *
+ * @param g The request group.
+ * @param capacity The total number of entries.
+ * @return Whether the entries could be allocated.
+ */
+bool raid_request_group_reserve(raid_request_group_t* g, size_t capacity);
+
 /**
  * @brief De-allocate and destroy a request group.
  *
@@ -913,16 +1665,23 @@ void raid_request_group_delete(raid_request_group_t* g);
 /**
  * @brief Adds an entry to the request group.
  *
+ * Entries are stored contiguously, so the returned pointer is only valid
+ * until the next entry is added. Entries can't be added while requests
+ * sent by the group are pending.
+ *
  * @param g The request group.
- * @return The new entry.
+ * @return The new entry, or NULL if it can't be added.
  */
 raid_request_group_entry_t* raid_request_group_add(raid_request_group_t* g);
 
 /**
  * @brief Send all the requests in this group.
  *
+ * A group can be sent again once every request it sent before is done.
+ *
  * @param g The request group.
- * @return Any errors that might occur sending the requests.
+ * @return RAID_INVALID_ARGUMENT if requests sent by the group are pending,
+ *         otherwise any errors that might occur sending the requests.
  */
 raid_error_t raid_request_group_send(raid_request_group_t* g);
 
@@ -941,6 +1700,67 @@ void raid_request_group_wait(raid_request_group_t* g);
  */
 raid_error_t raid_request_group_send_and_wait(raid_request_group_t* g);
 
+/**
+ * @brief Cancel the pending requests in this group.
+ *
+ * The entries of canceled requests are done with the RAID_CANCELED error.
+ *
+ * @param g The request group.
+ */
+void raid_request_group_cancel(raid_request_group_t* g);
+
+/**
+ * @brief Set a deadline shared by every request in this group.
+ *
+ * Requests still pending when it passes are done with the RAID_RECV_TIMEOUT error,
+ * and the group's waits return by then. A waiting thread expires them on time,
+ * without one it's up to the receive thread, with the granularity described in
+ * @ref raid_request_async_until. Must be set before sending the group.
+ *
+ * @param g The request group.
+ * @param deadline_ms Deadline on @ref raid_clock_ms, or RAID_NO_DEADLINE.
+ */
+void raid_request_group_set_deadline(raid_request_group_t* g, int64_t deadline_ms);
+
+/**
+ * @brief Wait until all the requests in this group are done or the deadline passes.
+ *
+ * @param g The request group.
+ * @param deadline_ms Deadline on @ref raid_clock_ms, or RAID_NO_DEADLINE.
+ * @return Whether all the requests are done.
+ */
+bool raid_request_group_wait_until(raid_request_group_t* g, int64_t deadline_ms);
+
+/**
+ * @brief Wait until at least some of the requests in this group are done.
+ *
+ * @param g The request group.
+ * @param count How many requests must be done.
+ * @param deadline_ms Deadline on @ref raid_clock_ms, or RAID_NO_DEADLINE.
+ * @return Whether count requests are done.
+ */
+bool raid_request_group_wait_quorum(raid_request_group_t* g, size_t count, int64_t deadline_ms);
+
+/**
+ * @brief Return the next done entry, in the order the responses arrived, without waiting.
+ *
+ * Each entry is returned only once, by this function or @ref raid_request_group_wait_any.
+ *
+ * @param g The request group.
+ * @return The entry, or NULL if none is ready.
+ */
+raid_request_group_entry_t* raid_request_group_next_ready(raid_request_group_t* g);
+
+/**
+ * @brief Wait for the next done entry, in the order the responses arrived.
+ *
+ * Each entry is returned only once, by this function or @ref raid_request_group_next_ready.
+ *
+ * @param g The request group.
+ * @return The entry, or NULL if every entry was already returned.
+ */
+raid_request_group_entry_t* raid_request_group_wait_any(raid_request_group_t* g);
+
 /**
  * @brief Read the responses from each request and put them into an array in @p out_reader
  *
@@ -950,6 +1770,18 @@ raid_error_t raid_request_group_send_and_wait(raid_request_group_t* g);
  */
 void raid_request_group_read_to_array(raid_request_group_t* g, raid_reader_t* out_reader, raid_error_t** out_errs);
 
+/**
+ * @brief Present the responses from each request as an array in @p out_reader, without copying them.
+ *
+ * The reader points into the group's entries, so it's only valid until the group is
+ * destroyed or sent again.
+ *
+ * @param g The request group.
+ * @param [out] out_reader The reader to receive the array with the responses.
+ * @param [out] out_errs Pointer to array of errors to receive response errors (optional). The caller owns the array.
+ */
+void raid_request_group_read_to_array_view(raid_request_group_t* g, raid_reader_t* out_reader, raid_error_t** out_errs);
+
 /**
  * @brief Helper function to debug/trace memory allocation, equivalent to malloc.
  *
@@ -959,6 +1791,16 @@ void raid_request_group_read_to_array(raid_request_group_t* g, raid_reader_t* ou
  */
 void* raid_alloc(size_t size, const char* name);
 
+/**
+ * @brief Helper function to debug/trace memory reallocation, equivalent to realloc.
+ *
+ * @param ptr Pointer to memory being resized, can be NULL.
+ * @param size Number of bytes to allocate.
+ * @param name Debug name for the allocation.
+ * @return Pointer to reallocated memory, or NULL leaving ptr untouched.
+ */
+void* raid_realloc(void* ptr, size_t size, const char* name);
+
 /**
  * @brief Helper function to debug/trace memory deallocation, equivalent to free.
  *
@@ -10,15 +10,40 @@
 
 #define RAID_TIMEOUT_DEFAULT_SECS (10)
 
+#define RAID_CONNECT_TIMEOUT_DEFAULT_MS (10*1000)
+
+#define RAID_RECV_TIMEOUT_DEFAULT_MS (10*1000)
+
+#define RAID_KEEPALIVE_IDLE_DEFAULT_SECS (30)
+#define RAID_KEEPALIVE_INTERVAL_DEFAULT_SECS (10)
+#define RAID_KEEPALIVE_COUNT_DEFAULT (3)
+
 // 1GB
 #define RAID_MAX_MSG_SIZE (1*1024*1024*1024)
 
+// The receive buffer starts this big and doubles as the frame arrives.
+#define RAID_MSG_BUF_INITIAL_SIZE (64*1024)
+
+// The receive buffer is kept between frames up to this size.
+#define RAID_MSG_BUF_KEEP_SIZE (1024*1024)
+
+// Requests with up to this many segments are sent without allocating.
+#define RAID_SEND_STACK_BUFS 8
+
+// Condition variables wait on the same clock as raid_clock_ms where pthreads allows it.
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define RAID_COND_MONOTONIC
+#endif
+
+#define RAID_RECONNECT_MIN_DELAY_MS (100)
+#define RAID_RECONNECT_MAX_DELAY_MS (10*1000)
+
 typedef struct {
     pthread_cond_t cond_var;
     pthread_mutex_t mutex;
     bool done;
     raid_error_t err;
-    raid_writer_t response_writer;
+    raid_reader_t response_reader; // the caller's reader, swapped with the response
 } request_sync_data_t;
 
 static ATOMIC_COUNTER_TYPE g_num_clients;
@@ -71,53 +96,323 @@ static void destroy_global_context()
 
 #endif
 
-static void call_before_send_callbacks(raid_client_t* cl, const char* data, size_t data_len)
+// Start walking a snapshot of the callbacks, it stays valid until release_callbacks.
+static raid_callback_list_t* acquire_callbacks(raid_client_t* cl, raid_callback_type_t type)
+{
+    if (!ATOMIC_READ_PTR(cl->callbacks[type])) {
+        return NULL;
+    }
+    ATOMIC_ADD(cl->callback_readers, 1);
+    raid_callback_list_t* list = ATOMIC_READ_PTR(cl->callbacks[type]);
+    if (!list) {
+        ATOMIC_SUB(cl->callback_readers, 1);
+    }
+    return list;
+}
+
+static void release_callbacks(raid_client_t* cl)
+{
+    ATOMIC_SUB(cl->callback_readers, 1);
+}
+
+static void free_callback_lists(raid_callback_list_t* list)
+{
+    while (list) {
+        raid_callback_list_t* next = list->next_retired;
+        free(list);
+        list = next;
+    }
+}
+
+static void free_subscription_tables(raid_subscription_table_t* table)
+{
+    while (table) {
+        raid_subscription_table_t* next = table->next_retired;
+        free(table);
+        table = next;
+    }
+}
+
+// Free the replaced snapshots if nobody is walking them, callbacks_mutex must be held.
+static void free_retired_callbacks(raid_client_t* cl)
+{
+    // Readers from now on only see the new snapshots, so with none left the old ones can go.
+    if (ATOMIC_READ(cl->callback_readers) == 0) {
+        free_callback_lists(cl->retired_callbacks);
+        cl->retired_callbacks = NULL;
+        free_subscription_tables(cl->retired_subscriptions);
+        cl->retired_subscriptions = NULL;
+    }
+}
+
+// Swap in a new snapshot, callbacks_mutex must be held.
+static void publish_callbacks(raid_client_t* cl, raid_callback_type_t type, raid_callback_list_t* list)
+{
+    raid_callback_list_t* old = ATOMIC_EXCHANGE_PTR(cl->callbacks[type], list);
+    if (old) {
+        old->next_retired = cl->retired_callbacks;
+        cl->retired_callbacks = old;
+    }
+    free_retired_callbacks(cl);
+}
+
+// Swap in a new subscription table, callbacks_mutex must be held.
+static void publish_subscriptions(raid_client_t* cl, raid_subscription_table_t* table)
+{
+    raid_subscription_table_t* old = ATOMIC_EXCHANGE_PTR(cl->subscriptions, table);
+    if (old) {
+        old->next_retired = cl->retired_subscriptions;
+        cl->retired_subscriptions = old;
+    }
+    free_retired_callbacks(cl);
+}
+
+// FNV-1a.
+static uint32_t hash_action(const char* action, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)action[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Build a table in a single allocation, copying the action strings,
+// the subscriptions are grouped by bucket keeping their order.
+static raid_subscription_table_t* build_subscriptions(const raid_subscription_t* subs, size_t num_subs)
+{
+    size_t num_buckets = 1;
+    while (num_buckets < num_subs) num_buckets <<= 1;
+
+    size_t strings_len = 0;
+    for (size_t i = 0; i < num_subs; i++) {
+        strings_len += subs[i].action_len + 1;
+    }
+
+    raid_subscription_table_t* table = malloc(sizeof(raid_subscription_table_t) +
+                                              num_subs * sizeof(raid_subscription_t) +
+                                              (num_buckets + 1) * sizeof(size_t) +
+                                              strings_len);
+    if (!table) return NULL;
+
+    table->next_retired = NULL;
+    table->num_subscriptions = num_subs;
+    table->num_buckets = num_buckets;
+    table->subscriptions = (raid_subscription_t*)(table + 1);
+    table->buckets = (size_t*)(table->subscriptions + num_subs);
+    char* strings = (char*)(table->buckets + num_buckets + 1);
+
+    // Counting sort by bucket, buckets[i] ends up as the start of bucket i.
+    size_t mask = num_buckets - 1;
+    memset(table->buckets, 0, (num_buckets + 1) * sizeof(size_t));
+    for (size_t i = 0; i < num_subs; i++) {
+        table->buckets[(subs[i].hash & mask) + 1]++;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        table->buckets[i + 1] += table->buckets[i];
+    }
+    for (size_t i = 0; i < num_subs; i++) {
+        raid_subscription_t* sub = &table->subscriptions[table->buckets[subs[i].hash & mask]++];
+        *sub = subs[i];
+        memcpy(strings, subs[i].action, subs[i].action_len);
+        strings[subs[i].action_len] = '\0';
+        sub->action = strings;
+        strings += subs[i].action_len + 1;
+    }
+    // The placement above moved each start to the next bucket, shift them back.
+    for (size_t i = num_buckets; i > 0; i--) {
+        table->buckets[i] = table->buckets[i - 1];
+    }
+    table->buckets[0] = 0;
+    return table;
+}
+
+static bool same_subscription(const raid_subscription_t* a, const raid_subscription_t* b)
+{
+    return a->hash == b->hash &&
+           a->action_len == b->action_len &&
+           a->callback == b->callback &&
+           a->user_data == b->user_data &&
+           !memcmp(a->action, b->action, a->action_len);
+}
+
+static void add_callback(raid_client_t* cl, const raid_callback_t* cb)
 {
-    raid_callback_t* cb = cl->callbacks;
-    while (cb) {
-        if (cb->type == RAID_CALLBACK_BEFORE_SEND) {
-            cb->callback.before_send(cl, data, data_len, cb->user_data);
+    pthread_mutex_lock(&cl->callbacks_mutex);
+    raid_callback_list_t* old = cl->callbacks[cb->type];
+    size_t num_callbacks = old ? old->num_callbacks : 0;
+
+    raid_callback_list_t* list = malloc(sizeof(raid_callback_list_t) + (num_callbacks + 1) * sizeof(raid_callback_t));
+    if (list) {
+        list->next_retired = NULL;
+        list->num_callbacks = num_callbacks + 1;
+        if (old) {
+            memcpy(list->callbacks, old->callbacks, num_callbacks * sizeof(raid_callback_t));
         }
-        cb = cb->next;
+        list->callbacks[num_callbacks] = *cb;
+        publish_callbacks(cl, cb->type, list);
     }
+    pthread_mutex_unlock(&cl->callbacks_mutex);
 }
 
-static void call_after_recv_callbacks(raid_client_t* cl, const char* data, size_t data_len)
+static bool same_callback(const raid_callback_t* a, const raid_callback_t* b)
+{
+    if (a->type != b->type || a->user_data != b->user_data) {
+        return false;
+    }
+    switch (a->type) {
+    case RAID_CALLBACK_BEFORE_SEND: return a->callback.before_send == b->callback.before_send;
+    case RAID_CALLBACK_AFTER_RECV: return a->callback.after_recv == b->callback.after_recv;
+    case RAID_CALLBACK_MSG_RECV: return a->callback.msg_recv == b->callback.msg_recv;
+    case RAID_CALLBACK_RECONNECT: return a->callback.reconnect == b->callback.reconnect;
+    default: return false;
+    }
+}
+
+static bool remove_callback(raid_client_t* cl, const raid_callback_t* cb)
 {
-    raid_callback_t* cb = cl->callbacks;
-    while (cb) {
-        if (cb->type == RAID_CALLBACK_AFTER_RECV) {
-            cb->callback.after_recv(cl, data, data_len, cb->user_data);
+    bool found = false;
+    pthread_mutex_lock(&cl->callbacks_mutex);
+    raid_callback_list_t* old = cl->callbacks[cb->type];
+    size_t num_callbacks = old ? old->num_callbacks : 0;
+
+    for (size_t i = 0; i < num_callbacks && !found; i++) {
+        if (!same_callback(&old->callbacks[i], cb)) continue;
+        found = true;
+
+        // The last one out leaves no list behind, so dispatching costs a NULL check.
+        raid_callback_list_t* list = NULL;
+        if (num_callbacks > 1) {
+            list = malloc(sizeof(raid_callback_list_t) + (num_callbacks - 1) * sizeof(raid_callback_t));
+            if (!list) {
+                found = false;
+                break;
+            }
+            list->next_retired = NULL;
+            list->num_callbacks = num_callbacks - 1;
+            memcpy(list->callbacks, old->callbacks, i * sizeof(raid_callback_t));
+            memcpy(list->callbacks + i, old->callbacks + i + 1, (num_callbacks - i - 1) * sizeof(raid_callback_t));
         }
-        cb = cb->next;
+        publish_callbacks(cl, cb->type, list);
     }
+    pthread_mutex_unlock(&cl->callbacks_mutex);
+    return found;
+}
+
+static void call_before_send_callbacks(raid_client_t* cl, const char* data, size_t data_len)
+{
+    raid_callback_list_t* list = acquire_callbacks(cl, RAID_CALLBACK_BEFORE_SEND);
+    if (!list) return;
+
+    for (size_t i = 0; i < list->num_callbacks; i++) {
+        raid_callback_t* cb = &list->callbacks[i];
+        cb->callback.before_send(cl, data, data_len, cb->user_data);
+    }
+    release_callbacks(cl);
+}
+
+static void call_before_send_callbacks_writer(raid_client_t* cl, const raid_writer_t* w)
+{
+    if (!ATOMIC_READ_PTR(cl->callbacks[RAID_CALLBACK_BEFORE_SEND])) return;
+
+    if (w->num_refs == 0) {
+        call_before_send_callbacks(cl, w->sbuf.data, w->sbuf.size);
+        return;
+    }
+
+    // The callbacks want contiguous data, flatten a copy of the message.
+    raid_writer_t copy;
+    raid_writer_init(&copy, cl);
+    raid_buf_t* bufs = raid_alloc(sizeof(raid_buf_t) * raid_writer_num_segments(w), "flatten bufs");
+    size_t num_bufs = raid_writer_segments(w, bufs);
+    for (size_t i = 0; i < num_bufs; i++) {
+        raid_write_raw(&copy, bufs[i].data, bufs[i].len);
+    }
+    raid_dealloc(bufs, "flatten bufs");
+
+    call_before_send_callbacks(cl, copy.sbuf.data, copy.sbuf.size);
+    raid_writer_destroy(&copy);
+}
+
+static void call_after_recv_callbacks(raid_client_t* cl, const char* data, size_t data_len)
+{
+    raid_callback_list_t* list = acquire_callbacks(cl, RAID_CALLBACK_AFTER_RECV);
+    if (!list) return;
+
+    for (size_t i = 0; i < list->num_callbacks; i++) {
+        raid_callback_t* cb = &list->callbacks[i];
+        cb->callback.after_recv(cl, data, data_len, cb->user_data);
+    }
+    release_callbacks(cl);
 }
 
 static void call_msg_recv_callbacks(raid_client_t* cl, raid_reader_t* r)
 {
-    raid_callback_t* cb = cl->callbacks;
-    while (cb) {
-        if (cb->type == RAID_CALLBACK_MSG_RECV) {
-            cb->callback.msg_recv(cl, r, cb->user_data);
+    raid_callback_list_t* list = acquire_callbacks(cl, RAID_CALLBACK_MSG_RECV);
+    if (!list) return;
+
+    for (size_t i = 0; i < list->num_callbacks; i++) {
+        raid_callback_t* cb = &list->callbacks[i];
+        cb->callback.msg_recv(cl, r, cb->user_data);
+    }
+    release_callbacks(cl);
+}
+
+static void call_subscriptions(raid_client_t* cl, raid_reader_t* r)
+{
+    const char* action;
+    size_t action_len;
+    if (!ATOMIC_READ_PTR(cl->subscriptions) || !raid_read_action_view(r, &action, &action_len)) {
+        return;
+    }
+
+    ATOMIC_ADD(cl->callback_readers, 1);
+    raid_subscription_table_t* table = ATOMIC_READ_PTR(cl->subscriptions);
+    if (table) {
+        uint32_t hash = hash_action(action, action_len);
+        size_t bucket = hash & (table->num_buckets - 1);
+        for (size_t i = table->buckets[bucket]; i < table->buckets[bucket + 1]; i++) {
+            raid_subscription_t* sub = &table->subscriptions[i];
+            if (sub->hash != hash || sub->action_len != action_len) continue;
+            if (memcmp(sub->action, action, action_len)) continue;
+
+            sub->callback(cl, r, sub->user_data);
         }
-        cb = cb->next;
     }
+    release_callbacks(cl);
 }
 
 static void clear_callbacks(raid_client_t* cl)
 {
-    raid_callback_t* cb = cl->callbacks;
-    while (cb) {
-        raid_callback_t* swap = cb;
-        cb = cb->next;
-        free(swap);
+    for (int type = 0; type < RAID_CALLBACK_NUM_TYPES; type++) {
+        free(cl->callbacks[type]);
+        cl->callbacks[type] = NULL;
+    }
+    free_callback_lists(cl->retired_callbacks);
+    cl->retired_callbacks = NULL;
+    free(cl->subscriptions);
+    cl->subscriptions = NULL;
+    free_subscription_tables(cl->retired_subscriptions);
+    cl->retired_subscriptions = NULL;
+}
+
+static void call_reconnect_callbacks(raid_client_t* cl)
+{
+    raid_callback_list_t* list = acquire_callbacks(cl, RAID_CALLBACK_RECONNECT);
+    if (!list) return;
+
+    for (size_t i = 0; i < list->num_callbacks; i++) {
+        raid_callback_t* cb = &list->callbacks[i];
+        cb->callback.reconnect(cl, cb->user_data);
     }
-    cl->callbacks = NULL;
+    release_callbacks(cl);
 }
 
 static void free_request(raid_request_t* req)
 {
     const char* etag = req->etag;
+    raid_dealloc(req->replay, "request.replay");
     raid_dealloc(req, etag);
     free((void*)etag);
 }
@@ -134,26 +429,38 @@ static raid_request_t* find_request(raid_client_t* cl, const char* etag)
     return NULL;
 }
 
+// Remove a request from the pending list, reqs_mutex must be held.
+static void unlink_request(raid_client_t* cl, raid_request_t* req)
+{
+    LIST_REMOVE(cl->reqs, req);
+    cl->num_requests--;
+    if (req->handle) {
+        *req->handle = NULL;
+        req->handle = NULL;
+    }
+}
+
 static void reply_request(raid_client_t* cl, raid_reader_t* r)
 {
-    // Find the request to reply to.
+    // Find the request to reply to and take it in the same critical section,
+    // otherwise a cancel could unlink and free it in between.
     raid_request_t* req = NULL;
 
     pthread_mutex_lock(&cl->reqs_mutex);
     if (r->etag_obj) {
         req = find_request(cl, r->etag_obj->via.str.ptr);
     }
+    if (req) {
+        unlink_request(cl, req);
+    }
     pthread_mutex_unlock(&cl->reqs_mutex);
 
     if (!req) {
+        // Unsolicited, or the request is gone already (canceled or timed out).
+        call_subscriptions(cl, r);
         call_msg_recv_callbacks(cl, r);
     }
     else {
-        pthread_mutex_lock(&cl->reqs_mutex);
-        cl->num_requests--;
-        LIST_REMOVE(cl->reqs, req);
-        pthread_mutex_unlock(&cl->reqs_mutex);
-
         // Fire the request callback.
         req->callback(cl, r, RAID_SUCCESS, req->callback_user_data);
 
@@ -161,36 +468,129 @@ static void reply_request(raid_client_t* cl, raid_reader_t* r)
     }
 }
 
+// Hand out the parsed frame and give the reader back to the pool.
+static void parse_reader(raid_client_t* cl, raid_reader_t* r)
+{
+    if (r->obj->type == MSGPACK_OBJECT_MAP) {
+        reply_request(cl, r);
+    }
+
+    raid_reader_destroy_pooled(cl, r);
+}
+
+// Parse the frame in msg_buf. It's copied into a pooled reader so both buffers get reused.
 static void parse_response(raid_client_t* cl)
 {
     raid_reader_t r;
-    raid_reader_init(&r);
+    raid_reader_init_pooled(cl, &r);
     raid_reader_set_data(&r, cl->msg_buf, cl->msg_len, true);
+    parse_reader(cl, &r);
 
-    if (r.obj->type == MSGPACK_OBJECT_MAP) {
-        reply_request(cl, &r);
+    // Don't hold on to the memory of a one-off large frame.
+    if (cl->msg_buf_cap > RAID_MSG_BUF_KEEP_SIZE) {
+        raid_dealloc(cl->msg_buf, "msg_buf");
+        cl->msg_buf = NULL;
+        cl->msg_buf_cap = 0;
+    }
+}
+
+// Parse a spilled frame, too large to copy, the reader takes ownership of data.
+static void parse_spilled_response(raid_client_t* cl, char* data, bool mapped)
+{
+    raid_reader_t r;
+    raid_reader_init_pooled(cl, &r);
+    if (mapped) {
+        raid_reader_take_mapped(&r, data, cl->msg_len, true);
     }
+    else {
+        raid_reader_take_data(&r, data, cl->msg_len, true);
+    }
+    parse_reader(cl, &r);
+}
 
-    raid_reader_destroy(&r);
+// Drop the frame being received, if any.
+static void discard_message(raid_client_t* cl, const char* name)
+{
+    raid_dealloc(cl->msg_buf, name);
+    cl->msg_buf = NULL;
+    cl->msg_buf_cap = 0;
+    if (cl->msg_spill) {
+        fclose(cl->msg_spill);
+        cl->msg_spill = NULL;
+    }
+    cl->state = RAID_STATE_WAIT_MESSAGE;
+}
+
+// Make room for the next len bytes of the frame, growing geometrically up to its total size.
+static bool reserve_message(raid_client_t* cl, size_t len)
+{
+    size_t needed = cl->msg_len + len;
+    if (needed <= cl->msg_buf_cap) return true;
+
+    size_t cap = cl->msg_buf_cap > RAID_MSG_BUF_INITIAL_SIZE ? cl->msg_buf_cap : RAID_MSG_BUF_INITIAL_SIZE;
+    while (cap < needed) cap *= 2;
+    if (cap > cl->msg_total_size) cap = cl->msg_total_size;
+
+    char* buf = raid_realloc(cl->msg_buf, cap, "msg_buf");
+    if (!buf) return false;
+
+    cl->msg_buf = buf;
+    cl->msg_buf_cap = cap;
+    return true;
+}
+
+// Map a spilled frame to be parsed in place, or bring it back into memory if that fails.
+static char* load_spilled_message(raid_client_t* cl, bool* mapped)
+{
+    char* data = raid_map_file(cl->msg_spill, cl->msg_len);
+    *mapped = data != NULL;
+    if (!data) {
+        data = raid_alloc(cl->msg_len, "msg_buf (spill)");
+        rewind(cl->msg_spill);
+        if (data && fread(data, 1, cl->msg_len, cl->msg_spill) != cl->msg_len) {
+            raid_dealloc(data, "msg_buf (spill)");
+            data = NULL;
+        }
+    }
+    fclose(cl->msg_spill);
+    cl->msg_spill = NULL;
+    return data;
 }
 
 static int read_message(raid_client_t* cl)
 {
     switch (cl->state) {
     case RAID_STATE_WAIT_MESSAGE: {
-        if ((cl->in_end - cl->in_ptr) < 4) return -1;
-
-        uint32_t len = ((uint8_t)cl->in_ptr[0] << 24) | ((uint8_t)cl->in_ptr[1] << 16) | ((uint8_t)cl->in_ptr[2] << 8) | ((uint8_t)cl->in_ptr[3]);
-        if (len <= RAID_MAX_MSG_SIZE) {
-            cl->state = RAID_STATE_PROCESSING_MESSAGE;
-            cl->msg_total_size = len;
-            cl->msg_len = 0;
-            cl->msg_buf = raid_alloc(cl->msg_total_size*sizeof(char), "msg_buf");
-            return 4;
+        // The size might be split between two reads when messages are pipelined.
+        size_t copy_len = sizeof(cl->msg_header) - cl->msg_header_len;
+        if ((size_t)(cl->in_end - cl->in_ptr) < copy_len) {
+            copy_len = (size_t)(cl->in_end - cl->in_ptr);
         }
-        else {
+        memcpy(cl->msg_header + cl->msg_header_len, cl->in_ptr, copy_len);
+        cl->msg_header_len += copy_len;
+        if (cl->msg_header_len < sizeof(cl->msg_header)) {
+            return (int)copy_len;
+        }
+        cl->msg_header_len = 0;
+
+        const char* h = cl->msg_header;
+        uint32_t len = ((uint8_t)h[0] << 24) | ((uint8_t)h[1] << 16) | ((uint8_t)h[2] << 8) | ((uint8_t)h[3]);
+        if (len > cl->max_frame_size) {
+            fprintf(stderr, "[raid] frame of %u bytes is over the limit of %zu\n", len, cl->max_frame_size);
             return -1;
         }
+        if (len == 0) {
+            return (int)copy_len;
+        }
+
+        // Nothing is allocated until the data arrives, the length might be garbage.
+        cl->state = RAID_STATE_PROCESSING_MESSAGE;
+        cl->msg_total_size = len;
+        cl->msg_len = 0;
+        if (cl->spill_threshold && len > cl->spill_threshold) {
+            cl->msg_spill = tmpfile();
+        }
+        return (int)copy_len;
     }
 
     case RAID_STATE_PROCESSING_MESSAGE: {
@@ -200,17 +600,36 @@ static int read_message(raid_client_t* cl)
             copy_len = buf_left;
         }
 
-        memcpy(cl->msg_buf + cl->msg_len, cl->in_ptr, copy_len);
+        if (cl->msg_spill) {
+            if (fwrite(cl->in_ptr, 1, copy_len, cl->msg_spill) != copy_len) {
+                return -1;
+            }
+        }
+        else {
+            if (!reserve_message(cl, copy_len)) {
+                return -1;
+            }
+            memcpy(cl->msg_buf + cl->msg_len, cl->in_ptr, copy_len);
+        }
         cl->msg_len += copy_len;
 
         if (cl->msg_len >= cl->msg_total_size) {
-            call_after_recv_callbacks(cl, cl->msg_buf, cl->msg_len);
-            parse_response(cl);
-            raid_dealloc(cl->msg_buf, "msg_buf");
-            cl->msg_buf = NULL;
+            if (cl->msg_spill) {
+                bool mapped = false;
+                char* data = load_spilled_message(cl, &mapped);
+                if (!data) {
+                    return -1;
+                }
+                call_after_recv_callbacks(cl, data, cl->msg_len);
+                parse_spilled_response(cl, data, mapped);
+            }
+            else {
+                call_after_recv_callbacks(cl, cl->msg_buf, cl->msg_len);
+                parse_response(cl);
+            }
             cl->state = RAID_STATE_WAIT_MESSAGE;
         }
-        return copy_len;
+        return (int)copy_len;
     }
 
     default:
@@ -218,19 +637,19 @@ static int read_message(raid_client_t* cl)
     }
 }
 
-static void process_data(raid_client_t* cl, const char* buf, size_t buf_len)
+// Returns false when the stream can't be trusted anymore.
+static bool process_data(raid_client_t* cl, const char* buf, size_t buf_len)
 {
     cl->in_ptr = buf;
     cl->in_end = buf + buf_len;
     while (cl->in_ptr < cl->in_end) {
         int i = read_message(cl);
-        if (i > 0) {
-            cl->in_ptr += i;
-        }
-        else {
-            break;
+        if (i < 0) {
+            return false;
         }
+        cl->in_ptr += i;
     }
+    return true;
 }
 
 static void sync_request_callback(raid_client_t* cl, raid_reader_t* r, raid_error_t err, void* user_data)
@@ -239,9 +658,10 @@ static void sync_request_callback(raid_client_t* cl, raid_reader_t* r, raid_erro
 
     request_sync_data_t* data = (request_sync_data_t*)user_data;
     if (err == RAID_SUCCESS) {
-        // To be safe, copy the data from the reader to our writer
-        // (just swapping the pointers from another thread gives scary results)
-        raid_write_object(&data->response_writer, r->obj);
+        // The response moves to the caller's reader without copying, and the caller's
+        // previous buffers go back to the pool with r. The caller only looks at
+        // it after being signaled below.
+        raid_reader_swap(r, &data->response_reader);
     }
 
     data->err = err;
@@ -251,10 +671,10 @@ static void sync_request_callback(raid_client_t* cl, raid_reader_t* r, raid_erro
     pthread_mutex_unlock(&data->mutex);
 }
 
-static raid_error_t request_sync_init(request_sync_data_t* data, raid_client_t* cl)
+static raid_error_t request_sync_init(request_sync_data_t* data, raid_reader_t* out)
 {
     memset(data, 0, sizeof(request_sync_data_t));
-    raid_writer_init(&data->response_writer, cl);
+    data->response_reader = *out;
 
     int err = pthread_mutex_init(&data->mutex, NULL);
     if (err != 0) {
@@ -269,11 +689,12 @@ static raid_error_t request_sync_init(request_sync_data_t* data, raid_client_t*
     return RAID_SUCCESS;
 }
 
-static void request_sync_destroy(request_sync_data_t* data)
+// Hands the reader back to the caller.
+static void request_sync_destroy(request_sync_data_t* data, raid_reader_t* out)
 {
     pthread_mutex_destroy(&data->mutex);
     pthread_cond_destroy(&data->cond_var);
-    raid_writer_destroy(&data->response_writer);
+    *out = data->response_reader;
 }
 
 static void clear_requests_locked(raid_client_t* cl)
@@ -281,6 +702,9 @@ static void clear_requests_locked(raid_client_t* cl)
     pthread_mutex_lock(&cl->reqs_mutex);
     raid_request_t* req = cl->reqs;
     while (req) {
+        if (req->handle) {
+            *req->handle = NULL;
+        }
         req->callback(cl, NULL, RAID_NOT_CONNECTED, req->callback_user_data);
 
         raid_request_t* swap = req;
@@ -293,60 +717,242 @@ static void clear_requests_locked(raid_client_t* cl)
     pthread_mutex_unlock(&cl->reqs_mutex);
 }
 
-static void check_requests_for_timeout_locked(raid_client_t* cl, raid_error_t recv_err)
+static void check_requests_for_timeout(raid_client_t* cl, raid_error_t recv_err)
 {
-    pthread_mutex_lock(&cl->reqs_mutex);
-
     int64_t now_time = (int64_t)time(NULL);
+    int64_t now_ms = raid_clock_ms();
     raid_request_t* req = cl->reqs;
     while (req) {
         raid_request_t* next_req = req->next;
-        bool should_remove = (recv_err == RAID_NOT_CONNECTED) || ((now_time - req->created_at) > req->timeout_secs);
+        bool should_remove = (recv_err == RAID_NOT_CONNECTED) || ((now_time - req->created_at) > req->timeout_secs) ||
+                             (req->deadline_ms >= 0 && now_ms >= req->deadline_ms);
         if (should_remove) {
+            unlink_request(cl, req);
             req->callback(cl, NULL, recv_err, req->callback_user_data);
-
-            LIST_REMOVE(cl->reqs, req);
             free_request(req);
-            cl->num_requests--;
         }
 
         req = next_req;
     }
+}
 
+static void check_requests_for_timeout_locked(raid_client_t* cl, raid_error_t recv_err)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    check_requests_for_timeout(cl, recv_err);
     pthread_mutex_unlock(&cl->reqs_mutex);
 }
 
-static void* raid_recv_loop(void* arg)
+// Fail the pending requests that can't be sent again, reqs_mutex must be held.
+static void fail_requests_without_replay(raid_client_t* cl)
+{
+    raid_request_t* req = cl->reqs;
+    while (req) {
+        raid_request_t* next_req = req->next;
+        if (!req->replay) {
+            unlink_request(cl, req);
+            req->callback(cl, NULL, RAID_NOT_CONNECTED, req->callback_user_data);
+            free_request(req);
+        }
+        req = next_req;
+    }
+}
+
+// Send the pending requests again on a new connection, reqs_mutex must be held.
+// The requests keep their created_at and deadline_ms, replaying doesn't buy them more time.
+static raid_error_t replay_requests(raid_client_t* cl)
+{
+    raid_request_t* req = cl->reqs;
+    while (req) {
+        raid_error_t err = raid_socket_send(&cl->socket, req->replay, req->replay_len);
+        if (err != RAID_SUCCESS) {
+            return err;
+        }
+        req = req->next;
+    }
+    return RAID_SUCCESS;
+}
+
+// Forget a partially received message from a previous connection.
+static void reset_receive_state(raid_client_t* cl)
+{
+    discard_message(cl, "msg_buf (reconnect)");
+    cl->msg_header_len = 0;
+}
+
+// Exponential backoff with jitter, the first attempt is immediate.
+static int64_t reconnect_delay_ms(raid_client_t* cl, int attempt)
+{
+    if (attempt == 0) {
+        return 0;
+    }
+
+    int64_t delay = cl->reconnect_min_ms;
+    for (int i = 1; i < attempt && delay < cl->reconnect_max_ms; i++) {
+        delay *= 2;
+    }
+    if (delay > cl->reconnect_max_ms) {
+        delay = cl->reconnect_max_ms;
+    }
+
+    // Spread clients that lost the same server over the upper half of the delay.
+    cl->reconnect_seed = cl->reconnect_seed * 1103515245u + 12345u;
+    int64_t half = delay / 2;
+    return half + (int64_t)((cl->reconnect_seed >> 8) % (uint32_t)(half + 1));
+}
+
+// Connect to the pre-resolved addresses or the host, without reqs_mutex since it can take a while.
+static raid_error_t connect_socket(raid_client_t* cl, raid_socket_t* s)
+{
+    if (raid_is_shm_address(cl->host)) {
+        return raid_shm_connect(s, cl->host + strlen(RAID_SHM_ADDRESS_PREFIX));
+    }
+
+    raid_address_t* addrs = NULL;
+    size_t num_addrs = 0;
+
+    pthread_mutex_lock(&cl->reqs_mutex);
+    if (cl->num_addresses > 0) {
+        addrs = malloc(cl->num_addresses * sizeof(raid_address_t));
+        if (addrs) {
+            memcpy(addrs, cl->addresses, cl->num_addresses * sizeof(raid_address_t));
+            num_addrs = cl->num_addresses;
+        }
+    }
+    bool resolve = cl->num_addresses == 0;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+
+    if (!addrs && !resolve) {
+        return RAID_UNKNOWN;
+    }
+    if (resolve) {
+        raid_error_t err = raid_resolve_cached(cl->host, cl->port, &addrs, &num_addrs);
+        if (err != RAID_SUCCESS) {
+            return err;
+        }
+    }
+
+    raid_error_t err = raid_socket_connect(s, addrs, num_addrs, cl->host);
+    if (err == RAID_CONNECT_ERROR && resolve) {
+        // The host might have moved, look it up again next time.
+        raid_address_cache_invalidate(cl->host, cl->port);
+    }
+    free(addrs);
+    return err;
+}
+
+// Reconnect after the connection dropped, returns whether the receive loop should go on.
+static bool reconnect(raid_client_t* cl)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    if (!cl->auto_reconnect || cl->closing) {
+        pthread_mutex_unlock(&cl->reqs_mutex);
+        return false;
+    }
+
+    reset_receive_state(cl);
+    fail_requests_without_replay(cl);
+
+    for (int attempt = 0; !cl->closing; attempt++) {
+        // raid_connect and raid_disconnect wake us up early.
+        int64_t deadline = raid_clock_ms() + reconnect_delay_ms(cl, attempt);
+        raid_cond_wait_until(&cl->reconnect_cond, &cl->reqs_mutex, deadline);
+        if (cl->closing) {
+            break;
+        }
+        check_requests_for_timeout(cl, RAID_RECV_TIMEOUT);
+
+        // Connecting can take a while, don't block the senders meanwhile.
+        raid_socket_t s = cl->socket;
+        s.handle = -1;
+        pthread_mutex_unlock(&cl->reqs_mutex);
+        raid_error_t err = connect_socket(cl, &s);
+        pthread_mutex_lock(&cl->reqs_mutex);
+
+        if (err != RAID_SUCCESS) {
+            continue;
+        }
+        if (cl->closing) {
+            raid_socket_close(&s);
+            break;
+        }
+
+        s.opts = cl->socket.opts;
+        cl->socket = s;
+        ATOMIC_ADD(cl->connection_id, 1);
+        if (replay_requests(cl) == RAID_SUCCESS) {
+            break;
+        }
+        raid_socket_close(&cl->socket);
+    }
+
+    bool connected = raid_socket_connected(&cl->socket);
+    pthread_mutex_unlock(&cl->reqs_mutex);
+
+    if (connected) {
+        call_reconnect_callbacks(cl);
+    }
+    return connected;
+}
+
+static void recv_until_disconnected(raid_client_t* cl)
 {
-    raid_client_t* cl = (raid_client_t*)arg;
     char buf[4096];
     int buf_len = 0;
 
     while (raid_socket_connected(&cl->socket)) {
         raid_error_t err = raid_socket_recv(&cl->socket, buf, sizeof(buf), &buf_len);
+        if (err == RAID_NOT_CONNECTED) {
+            // The connection dropped, the pending requests are dealt with by the caller.
+            pthread_mutex_lock(&cl->reqs_mutex);
+            if (raid_socket_connected(&cl->socket)) {
+                raid_socket_close(&cl->socket);
+            }
+            pthread_mutex_unlock(&cl->reqs_mutex);
+            break;
+        }
         if (err && err != RAID_RECV_TIMEOUT) {
             fprintf(stderr, "[raid] recv error: %s\n", raid_error_to_string(err));
         }
 
+        // Expire requests before handing out responses, so a deadline that passed
+        // is seen by then. TODO: discover remaining unknown errors in socket_recv
+        check_requests_for_timeout_locked(cl, err == RAID_SUCCESS ? RAID_RECV_TIMEOUT : err);
+
         if (buf_len > 0) {
-            process_data(cl, buf, buf_len);
+            if (!process_data(cl, buf, buf_len)) {
+                // The framing is lost, drop the connection like the server went away.
+                discard_message(cl, "msg_buf (bad frame)");
+                pthread_mutex_lock(&cl->reqs_mutex);
+                if (raid_socket_connected(&cl->socket)) {
+                    raid_socket_close(&cl->socket);
+                }
+                pthread_mutex_unlock(&cl->reqs_mutex);
+                break;
+            }
         }
         else if (err == RAID_RECV_TIMEOUT) {
-            check_requests_for_timeout_locked(cl, err);
             if (!cl->reqs && cl->state == RAID_STATE_PROCESSING_MESSAGE) {
-                cl->state = RAID_STATE_WAIT_MESSAGE;
-                raid_dealloc(cl->msg_buf, "msg_buf (timeout)");
-                cl->msg_buf = NULL;
+                discard_message(cl, "msg_buf (timeout)");
             }
         }
-        buf_len = 0;
-
-        // TODO: discover remaining unknown errors in socket_recv
-        if (err == RAID_SUCCESS) {
-            err = RAID_RECV_TIMEOUT;
+        if (cl->socket.zerocopy) {
+            // Sends don't wait for their zero-copy completions, pick them up here too.
+            pthread_mutex_lock(&cl->reqs_mutex);
+            raid_socket_zerocopy_pending(&cl->socket);
+            pthread_mutex_unlock(&cl->reqs_mutex);
         }
-        check_requests_for_timeout_locked(cl, err);
+        buf_len = 0;
     }
+}
+
+static void* raid_recv_loop(void* arg)
+{
+    raid_client_t* cl = (raid_client_t*)arg;
+
+    do {
+        recv_until_disconnected(cl);
+    } while (reconnect(cl));
 
     clear_requests_locked(cl);
     return NULL;
@@ -368,9 +974,27 @@ static void detach_recv_thread(raid_client_t* cl)
     }
 }
 
+void raid_socket_options_init(raid_socket_options_t* opts)
+{
+    memset(opts, 0, sizeof(raid_socket_options_t));
+    opts->connect_timeout_ms = RAID_CONNECT_TIMEOUT_DEFAULT_MS;
+    opts->recv_timeout_ms = RAID_RECV_TIMEOUT_DEFAULT_MS;
+    opts->nodelay = true;
+    opts->quickack = true;
+    opts->keepalive = true;
+    opts->keepalive_idle_secs = RAID_KEEPALIVE_IDLE_DEFAULT_SECS;
+    opts->keepalive_interval_secs = RAID_KEEPALIVE_INTERVAL_DEFAULT_SECS;
+    opts->keepalive_count = RAID_KEEPALIVE_COUNT_DEFAULT;
+}
+
 raid_error_t raid_init(raid_client_t* cl, const char* host, const char* port)
 {
-    if (!host || !port)
+    return raid_init_ex(cl, host, port, NULL);
+}
+
+raid_error_t raid_init_ex(raid_client_t* cl, const char* host, const char* port, const raid_socket_options_t* opts)
+{
+    if (!host || (!port && !raid_is_unix_address(host) && !raid_is_shm_address(host)))
         return RAID_INVALID_ARGUMENT;
 
     if (ATOMIC_READ(g_num_clients) == 0) {
@@ -381,30 +1005,79 @@ raid_error_t raid_init(raid_client_t* cl, const char* host, const char* port)
     memset(cl, 0, sizeof(raid_client_t));
     cl->state = RAID_STATE_WAIT_MESSAGE;
     cl->host = strdup(host);
-    cl->port = strdup(port);
+    cl->port = strdup(port ? port : "");
     cl->socket.handle = -1;
+    if (opts) {
+        cl->socket.opts = *opts;
+    }
+    else {
+        raid_socket_options_init(&cl->socket.opts);
+    }
     cl->request_timeout_secs = RAID_TIMEOUT_DEFAULT_SECS;
+    cl->max_frame_size = RAID_MAX_MSG_SIZE;
+    cl->reconnect_min_ms = RAID_RECONNECT_MIN_DELAY_MS;
+    cl->reconnect_max_ms = RAID_RECONNECT_MAX_DELAY_MS;
+    cl->reconnect_seed = (uint32_t)raid_clock_ms() ^ (uint32_t)(uintptr_t)cl;
 
     int err = pthread_mutex_init(&cl->reqs_mutex, NULL);
     if (err != 0) {
         fprintf(stderr, "Cannot create mutex: %s\n", strerror(err));
         return RAID_UNKNOWN;
     }
+
+    err = pthread_mutex_init(&cl->callbacks_mutex, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Cannot create mutex: %s\n", strerror(err));
+        return RAID_UNKNOWN;
+    }
+
+    err = pthread_mutex_init(&cl->pool_mutex, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Cannot create mutex: %s\n", strerror(err));
+        return RAID_UNKNOWN;
+    }
+
+    err = raid_cond_init(&cl->reconnect_cond);
+    if (err != 0) {
+        fprintf(stderr, "Cannot create condition variable: %s\n", strerror(err));
+        return RAID_UNKNOWN;
+    }
     return RAID_SUCCESS;
 }
 
 raid_error_t raid_connect(raid_client_t* cl)
 {
-    raid_error_t result = RAID_UNKNOWN;
     pthread_mutex_lock(&cl->reqs_mutex);
-
     if (raid_socket_connected(&cl->socket)) {
+        pthread_mutex_unlock(&cl->reqs_mutex);
+        return RAID_ALREADY_CONNECTED;
+    }
+    if (cl->recv_thread_active && cl->auto_reconnect) {
+        // The receiver thread is already reconnecting, make it try right away.
+        pthread_cond_broadcast(&cl->reconnect_cond);
+        pthread_mutex_unlock(&cl->reqs_mutex);
+        return RAID_NOT_CONNECTED;
+    }
+    cl->closing = false;
+
+    // Resolve and connect without the lock, so senders and other clients don't stall on it.
+    raid_socket_t s = cl->socket;
+    s.handle = -1;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+    raid_error_t result = connect_socket(cl, &s);
+    pthread_mutex_lock(&cl->reqs_mutex);
+
+    if (result == RAID_SUCCESS && raid_socket_connected(&cl->socket)) {
+        // Someone else connected meanwhile.
+        raid_socket_close(&s);
         result = RAID_ALREADY_CONNECTED;
     }
     else {
-        result = raid_socket_connect(&cl->socket, cl->host, cl->port);
         cl->recv_thread_active = false;
         if (result == RAID_SUCCESS) {
+            s.opts = cl->socket.opts;
+            cl->socket = s;
+
             // Increment connection id
             ATOMIC_ADD(cl->connection_id, 1);
 
@@ -436,29 +1109,187 @@ unsigned int raid_connection_id(raid_client_t* cl)
 
 void raid_add_before_send_callback(raid_client_t* cl, raid_before_send_callback_t cb, void* user_data)
 {
-    raid_callback_t* data = malloc(sizeof(raid_callback_t));
-    data->type = RAID_CALLBACK_BEFORE_SEND;
-    data->callback.before_send = cb;
-    data->user_data = user_data;
-    LIST_APPEND(cl->callbacks, data);
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_BEFORE_SEND;
+    data.callback.before_send = cb;
+    data.user_data = user_data;
+    add_callback(cl, &data);
 }
 
 void raid_add_after_recv_callback(raid_client_t* cl, raid_after_recv_callback_t cb, void* user_data)
 {
-    raid_callback_t* data = malloc(sizeof(raid_callback_t));
-    data->type = RAID_CALLBACK_AFTER_RECV;
-    data->callback.after_recv = cb;
-    data->user_data = user_data;
-    LIST_APPEND(cl->callbacks, data);
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_AFTER_RECV;
+    data.callback.after_recv = cb;
+    data.user_data = user_data;
+    add_callback(cl, &data);
 }
 
 void raid_add_msg_recv_callback(raid_client_t* cl, raid_msg_recv_callback_t cb, void* user_data)
 {
-    raid_callback_t* data = malloc(sizeof(raid_callback_t));
-    data->type = RAID_CALLBACK_MSG_RECV;
-    data->callback.msg_recv = cb;
-    data->user_data = user_data;
-    LIST_APPEND(cl->callbacks, data);
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_MSG_RECV;
+    data.callback.msg_recv = cb;
+    data.user_data = user_data;
+    add_callback(cl, &data);
+}
+
+void raid_add_reconnect_callback(raid_client_t* cl, raid_reconnect_callback_t cb, void* user_data)
+{
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_RECONNECT;
+    data.callback.reconnect = cb;
+    data.user_data = user_data;
+    add_callback(cl, &data);
+}
+
+bool raid_remove_before_send_callback(raid_client_t* cl, raid_before_send_callback_t cb, void* user_data)
+{
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_BEFORE_SEND;
+    data.callback.before_send = cb;
+    data.user_data = user_data;
+    return remove_callback(cl, &data);
+}
+
+bool raid_remove_after_recv_callback(raid_client_t* cl, raid_after_recv_callback_t cb, void* user_data)
+{
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_AFTER_RECV;
+    data.callback.after_recv = cb;
+    data.user_data = user_data;
+    return remove_callback(cl, &data);
+}
+
+bool raid_remove_msg_recv_callback(raid_client_t* cl, raid_msg_recv_callback_t cb, void* user_data)
+{
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_MSG_RECV;
+    data.callback.msg_recv = cb;
+    data.user_data = user_data;
+    return remove_callback(cl, &data);
+}
+
+bool raid_remove_reconnect_callback(raid_client_t* cl, raid_reconnect_callback_t cb, void* user_data)
+{
+    raid_callback_t data;
+    data.type = RAID_CALLBACK_RECONNECT;
+    data.callback.reconnect = cb;
+    data.user_data = user_data;
+    return remove_callback(cl, &data);
+}
+
+raid_error_t raid_subscribe(raid_client_t* cl, const char* action, raid_msg_recv_callback_t cb, void* user_data)
+{
+    if (!action || !cb) return RAID_INVALID_ARGUMENT;
+
+    raid_subscription_t sub;
+    sub.action = action;
+    sub.action_len = strlen(action);
+    sub.hash = hash_action(action, sub.action_len);
+    sub.callback = cb;
+    sub.user_data = user_data;
+
+    raid_error_t err = RAID_SUCCESS;
+    pthread_mutex_lock(&cl->callbacks_mutex);
+    raid_subscription_table_t* old = cl->subscriptions;
+    size_t num_subs = old ? old->num_subscriptions : 0;
+
+    raid_subscription_t* subs = malloc((num_subs + 1) * sizeof(raid_subscription_t));
+    raid_subscription_table_t* table = NULL;
+    if (subs) {
+        if (num_subs) {
+            memcpy(subs, old->subscriptions, num_subs * sizeof(raid_subscription_t));
+        }
+        subs[num_subs] = sub;
+        table = build_subscriptions(subs, num_subs + 1);
+        free(subs);
+    }
+
+    if (table) {
+        publish_subscriptions(cl, table);
+    }
+    else {
+        err = RAID_UNKNOWN;
+    }
+    pthread_mutex_unlock(&cl->callbacks_mutex);
+    return err;
+}
+
+bool raid_unsubscribe(raid_client_t* cl, const char* action, raid_msg_recv_callback_t cb, void* user_data)
+{
+    if (!action) return false;
+
+    raid_subscription_t sub;
+    sub.action = action;
+    sub.action_len = strlen(action);
+    sub.hash = hash_action(action, sub.action_len);
+    sub.callback = cb;
+    sub.user_data = user_data;
+
+    bool found = false;
+    pthread_mutex_lock(&cl->callbacks_mutex);
+    raid_subscription_table_t* old = cl->subscriptions;
+    size_t num_subs = old ? old->num_subscriptions : 0;
+
+    for (size_t i = 0; i < num_subs && !found; i++) {
+        if (!same_subscription(&old->subscriptions[i], &sub)) continue;
+
+        // Removing the last one leaves no table at all.
+        raid_subscription_table_t* table = NULL;
+        if (num_subs > 1) {
+            raid_subscription_t* subs = malloc((num_subs - 1) * sizeof(raid_subscription_t));
+            if (!subs) break;
+
+            memcpy(subs, old->subscriptions, i * sizeof(raid_subscription_t));
+            memcpy(subs + i, old->subscriptions + i + 1, (num_subs - i - 1) * sizeof(raid_subscription_t));
+            table = build_subscriptions(subs, num_subs - 1);
+            free(subs);
+            if (!table) break;
+        }
+        found = true;
+        publish_subscriptions(cl, table);
+    }
+    pthread_mutex_unlock(&cl->callbacks_mutex);
+    return found;
+}
+
+void raid_set_auto_reconnect(raid_client_t* cl, bool enabled, int64_t min_delay_ms, int64_t max_delay_ms)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    cl->auto_reconnect = enabled;
+    cl->reconnect_min_ms = min_delay_ms > 0 ? min_delay_ms : 1;
+    cl->reconnect_max_ms = max_delay_ms > cl->reconnect_min_ms ? max_delay_ms : cl->reconnect_min_ms;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+}
+
+raid_error_t raid_register_idempotent_action(raid_client_t* cl, const char* action)
+{
+    if (!action) return RAID_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&cl->reqs_mutex);
+    if (!raid_is_idempotent_action_locked(cl, action, strlen(action))) {
+        char** actions = realloc(cl->idempotent_actions, sizeof(char*) * (cl->num_idempotent_actions + 1));
+        if (actions == NULL) {
+            pthread_mutex_unlock(&cl->reqs_mutex);
+            return RAID_UNKNOWN;
+        }
+        cl->idempotent_actions = actions;
+        cl->idempotent_actions[cl->num_idempotent_actions++] = strdup(action);
+    }
+    pthread_mutex_unlock(&cl->reqs_mutex);
+    return RAID_SUCCESS;
+}
+
+bool raid_is_idempotent_action_locked(raid_client_t* cl, const char* action, size_t action_len)
+{
+    for (size_t i = 0; i < cl->num_idempotent_actions; i++) {
+        const char* a = cl->idempotent_actions[i];
+        if (strlen(a) == action_len && !memcmp(a, action, action_len)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void raid_set_request_timeout(raid_client_t* cl, int64_t timeout_secs)
@@ -466,47 +1297,232 @@ void raid_set_request_timeout(raid_client_t* cl, int64_t timeout_secs)
     cl->request_timeout_secs = timeout_secs;
 }
 
+void raid_set_max_frame_size(raid_client_t* cl, size_t max_size)
+{
+    cl->max_frame_size = max_size ? max_size : RAID_MAX_MSG_SIZE;
+}
+
+void raid_set_spill_threshold(raid_client_t* cl, size_t threshold)
+{
+    cl->spill_threshold = threshold;
+}
+
+void raid_set_zerocopy_threshold(raid_client_t* cl, size_t threshold)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    cl->socket.opts.zerocopy_threshold = threshold;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+}
+
+size_t raid_zerocopy_pending(raid_client_t* cl)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    size_t pending = raid_socket_zerocopy_pending(&cl->socket);
+    pthread_mutex_unlock(&cl->reqs_mutex);
+    return pending;
+}
+
+int raid_cond_init(pthread_cond_t* cond)
+{
+#ifdef RAID_COND_MONOTONIC
+    pthread_condattr_t attr;
+    int err = pthread_condattr_init(&attr);
+    if (err != 0) {
+        return err;
+    }
+    err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (err == 0) {
+        err = pthread_cond_init(cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+    return err;
+#else
+    return pthread_cond_init(cond, NULL);
+#endif
+}
+
+bool raid_cond_wait_until(pthread_cond_t* cond, pthread_mutex_t* mutex, int64_t deadline_ms)
+{
+    if (deadline_ms < 0) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+
+    int64_t left_ms = deadline_ms - raid_clock_ms();
+    if (left_ms <= 0) {
+        return false;
+    }
+
+    struct timespec ts;
+#ifdef RAID_COND_MONOTONIC
+    // Same clock as raid_clock_ms, so wall clock jumps don't move the deadline.
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#elif defined(_WIN32)
+    // Only a wall clock time is taken here, callers re-check the monotonic deadline.
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    ts.tv_sec += left_ms / 1000;
+    ts.tv_nsec += (left_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(cond, mutex, &ts);
+    return true;
+}
+
+void raid_set_connect_timeout(raid_client_t* cl, int64_t timeout_ms)
+{
+    pthread_mutex_lock(&cl->reqs_mutex);
+    cl->socket.opts.connect_timeout_ms = timeout_ms;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+}
+
+int64_t raid_clock_ms()
+{
+#ifdef _WIN32
+    return (int64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+raid_error_t raid_set_addresses(raid_client_t* cl, const raid_address_t* addrs, size_t num_addrs)
+{
+    if (num_addrs > 0 && !addrs)
+        return RAID_INVALID_ARGUMENT;
+
+    raid_address_t* copy = NULL;
+    if (num_addrs > 0) {
+        copy = malloc(num_addrs * sizeof(raid_address_t));
+        if (!copy) {
+            return RAID_UNKNOWN;
+        }
+        memcpy(copy, addrs, num_addrs * sizeof(raid_address_t));
+    }
+
+    pthread_mutex_lock(&cl->reqs_mutex);
+    free(cl->addresses);
+    cl->addresses = copy;
+    cl->num_addresses = num_addrs;
+    pthread_mutex_unlock(&cl->reqs_mutex);
+    return RAID_SUCCESS;
+}
+
 size_t raid_num_requests(raid_client_t* cl)
 {
     return cl->num_requests;
 }
 
-raid_error_t raid_request_async(raid_client_t* cl, const raid_writer_t* w, raid_response_callback_t cb, void* user_data)
+// Copy a whole frame, size included, to send it again later.
+static char* copy_frame(const raid_writer_t* w, const char* size, size_t* out_len)
 {
+    size_t len = 4 + raid_writer_wire_size(w);
+    char* frame = raid_alloc(len, "request.replay");
+    memcpy(frame, size, 4);
+
+    raid_buf_t* bufs = raid_alloc(sizeof(raid_buf_t) * raid_writer_num_segments(w), "replay bufs");
+    size_t num_bufs = raid_writer_segments(w, bufs);
+    size_t offset = 4;
+    for (size_t i = 0; i < num_bufs; i++) {
+        memcpy(frame + offset, bufs[i].data, bufs[i].len);
+        offset += bufs[i].len;
+    }
+    raid_dealloc(bufs, "replay bufs");
+
+    *out_len = len;
+    return frame;
+}
+
+raid_error_t raid_request_async_batch(raid_client_t* cl, const raid_request_batch_item_t* items, size_t num_items, raid_response_callback_t cb)
+{
+    if (num_items == 0) {
+        return RAID_SUCCESS;
+    }
+
     raid_error_t result = RAID_SUCCESS;
     pthread_mutex_lock(&cl->reqs_mutex);
 
     if (raid_socket_connected(&cl->socket)) {
-        // Send data to socket
-        int32_t size = w->sbuf.size;
-        char data_size[4];
-        data_size[0] = (size >> 24) & 0xFF;
-        data_size[1] = (size >> 16) & 0xFF;
-        data_size[2] = (size >> 8) & 0xFF;
-        data_size[3] = size & 0xFF;
+        // Every frame is its size followed by the writer's segments.
+        size_t num_bufs = 0;
+        for (size_t i = 0; i < num_items; i++) {
+            num_bufs += 1 + raid_writer_num_segments(items[i].writer);
+        }
+
+        raid_buf_t stack_bufs[RAID_SEND_STACK_BUFS];
+        char stack_sizes[RAID_SEND_STACK_BUFS][4];
+        raid_buf_t* bufs = stack_bufs;
+        char (*sizes)[4] = stack_sizes;
+        if (num_bufs > RAID_SEND_STACK_BUFS) {
+            bufs = raid_alloc(sizeof(raid_buf_t) * num_bufs, "send bufs");
+        }
+        if (num_items > RAID_SEND_STACK_BUFS) {
+            sizes = raid_alloc(sizeof(*sizes) * num_items, "send sizes");
+        }
+
+        num_bufs = 0;
+        for (size_t i = 0; i < num_items; i++) {
+            const raid_writer_t* w = items[i].writer;
+            int32_t size = raid_writer_wire_size(w);
+            sizes[i][0] = (size >> 24) & 0xFF;
+            sizes[i][1] = (size >> 16) & 0xFF;
+            sizes[i][2] = (size >> 8) & 0xFF;
+            sizes[i][3] = size & 0xFF;
+
+            call_before_send_callbacks_writer(cl, w);
+
+            bufs[num_bufs].data = sizes[i];
+            bufs[num_bufs].len = sizeof(sizes[i]);
+            bufs[num_bufs].zerocopy = false;
+            num_bufs++;
+            num_bufs += raid_writer_segments(w, bufs + num_bufs);
+        }
 
-        call_before_send_callbacks(cl, w->sbuf.data, size);
+        // Flush everything with as few syscalls as the socket allows.
+        result = raid_socket_sendv(&cl->socket, bufs, num_bufs);
 
-        result = raid_socket_send(&cl->socket, data_size, sizeof(data_size));
-        if (result == RAID_SUCCESS) {
-            result = raid_socket_send(&cl->socket, w->sbuf.data, size);
+        if (bufs != stack_bufs) {
+            raid_dealloc(bufs, "send bufs");
+        }
+        if (sizes != stack_sizes) {
+            raid_dealloc(sizes, "send sizes");
         }
 
         if (result == RAID_NOT_CONNECTED) {
+            // When reconnecting, closing the socket wakes up the receiver thread to do it.
             raid_socket_close(&cl->socket);
-            detach_recv_thread(cl);
+            if (!cl->auto_reconnect) {
+                detach_recv_thread(cl);
+            }
         }
         else if (result == RAID_SUCCESS) {
-            // Append a request to the list
-            raid_request_t* req = raid_alloc(sizeof(raid_request_t), w->etag);
-            memset(req, 0, sizeof(raid_request_t));
-            req->created_at = (int64_t)time(NULL);
-            req->timeout_secs = cl->request_timeout_secs;
-            req->etag = strdup(w->etag);
-            req->callback = cb;
-            req->callback_user_data = user_data;
-            LIST_APPEND(cl->reqs, req);
-            cl->num_requests++;
+            // Append the requests to the list
+            const int64_t now = (int64_t)time(NULL);
+            for (size_t i = 0; i < num_items; i++) {
+                const raid_writer_t* w = items[i].writer;
+                raid_request_t* req = raid_alloc(sizeof(raid_request_t), w->etag);
+                memset(req, 0, sizeof(raid_request_t));
+                req->created_at = now;
+                req->timeout_secs = cl->request_timeout_secs;
+                req->etag = strdup(w->etag);
+                req->callback = cb;
+                req->callback_user_data = items[i].user_data;
+                req->deadline_ms = items[i].deadline_ms;
+                if (cl->auto_reconnect && w->idempotent) {
+                    req->replay = copy_frame(w, sizes[i], &req->replay_len);
+                }
+                req->handle = items[i].handle;
+                if (req->handle) {
+                    *req->handle = req;
+                }
+                LIST_APPEND(cl->reqs, req);
+                cl->num_requests++;
+            }
         }
     }
     else {
@@ -517,19 +1533,30 @@ raid_error_t raid_request_async(raid_client_t* cl, const raid_writer_t* w, raid_
     return result;
 }
 
+raid_error_t raid_request_async(raid_client_t* cl, const raid_writer_t* w, raid_response_callback_t cb, void* user_data)
+{
+    return raid_request_async_until(cl, w, RAID_NO_DEADLINE, cb, user_data);
+}
+
+raid_error_t raid_request_async_until(raid_client_t* cl, const raid_writer_t* w, int64_t deadline_ms, raid_response_callback_t cb, void* user_data)
+{
+    raid_request_batch_item_t item = { w, user_data, NULL, deadline_ms };
+    return raid_request_async_batch(cl, &item, 1, cb);
+}
+
 raid_error_t raid_request(raid_client_t* cl, const raid_writer_t* w, raid_reader_t* out)
 {
     request_sync_data_t* data = malloc(sizeof(request_sync_data_t));
-    raid_error_t res = request_sync_init(data, cl);
+    raid_error_t res = request_sync_init(data, out);
     if (res != RAID_SUCCESS) {
-        request_sync_destroy(data);
+        request_sync_destroy(data, out);
         free(data);
         return res;
     }
 
     res = raid_request_async(cl, w, sync_request_callback, (void*)data);
     if (res != RAID_SUCCESS) {
-        request_sync_destroy(data);
+        request_sync_destroy(data, out);
         free(data);
         return res;
     }
@@ -541,11 +1568,7 @@ raid_error_t raid_request(raid_client_t* cl, const raid_writer_t* w, raid_reader
     pthread_mutex_unlock(&data->mutex);
 
     res = data->err;
-    if (res == RAID_SUCCESS) {
-        raid_reader_set_data(out, data->response_writer.sbuf.data, data->response_writer.sbuf.size, true);
-    }
-
-    request_sync_destroy(data);
+    request_sync_destroy(data, out);
     free(data);
     return res;
 }
@@ -557,19 +1580,44 @@ void raid_cancel_request(raid_client_t* cl, const char* etag)
     while (req) {
         raid_request_t* next_req = req->next;
         if (!strncmp(req->etag, etag, strlen(req->etag))) {
+            unlink_request(cl, req);
             req->callback(cl, NULL, RAID_CANCELED, req->callback_user_data);
-            LIST_REMOVE(cl->reqs, req);
             free_request(req);
-            cl->num_requests--;
         }
         req = next_req;
     }
     pthread_mutex_unlock(&cl->reqs_mutex);
 }
 
+void raid_cancel_requests(raid_client_t* cl, raid_request_t** const* handles, size_t num_handles, raid_error_t err)
+{
+    // Unlink everything in one locked pass, chaining the requests through their next pointers.
+    raid_request_t* canceled = NULL;
+    pthread_mutex_lock(&cl->reqs_mutex);
+    for (size_t i = 0; i < num_handles; i++) {
+        raid_request_t* req = *handles[i];
+        if (req) {
+            unlink_request(cl, req);
+            req->next = canceled;
+            canceled = req;
+        }
+    }
+    pthread_mutex_unlock(&cl->reqs_mutex);
+
+    // Nobody else can reach these requests now, fire the callbacks without the lock.
+    while (canceled) {
+        raid_request_t* next_req = canceled->next;
+        canceled->callback(cl, NULL, err, canceled->callback_user_data);
+        free_request(canceled);
+        canceled = next_req;
+    }
+}
+
 raid_error_t raid_disconnect(raid_client_t* cl)
 {
     pthread_mutex_lock(&cl->reqs_mutex);
+    cl->closing = true;
+    pthread_cond_broadcast(&cl->reconnect_cond);
     raid_error_t err = raid_socket_close(&cl->socket);
     pthread_mutex_unlock(&cl->reqs_mutex);
 
@@ -580,20 +1628,33 @@ raid_error_t raid_disconnect(raid_client_t* cl)
 void raid_destroy(raid_client_t* cl)
 {
     pthread_mutex_lock(&cl->reqs_mutex);
+    cl->closing = true;
+    pthread_cond_broadcast(&cl->reconnect_cond);
     if (raid_socket_connected(&cl->socket)) {
         (void)raid_socket_close(&cl->socket);
     }
     pthread_mutex_unlock(&cl->reqs_mutex);
 
     join_recv_thread(cl);
+    reset_receive_state(cl);
     pthread_mutex_destroy(&cl->reqs_mutex);
+    pthread_cond_destroy(&cl->reconnect_cond);
     clear_callbacks(cl);
+    pthread_mutex_destroy(&cl->callbacks_mutex);
+    for (size_t i = 0; i < cl->num_idempotent_actions; i++) {
+        free(cl->idempotent_actions[i]);
+    }
+    free(cl->idempotent_actions);
+    raid_reader_pool_clear(cl);
+    raid_writer_pool_clear(cl);
+    pthread_mutex_destroy(&cl->pool_mutex);
     if (cl->host) {
         free(cl->host);
     }
     if (cl->port) {
         free(cl->port);
     }
+    free(cl->addresses);
 
     ATOMIC_SUB(g_num_clients, 1);
     if (ATOMIC_READ(g_num_clients) == 0) {
@@ -27,25 +27,15 @@
     type* next; \
     type* prev; \
 
-#define LIST_FOREACH(type, item, list) for (type* item = type##_list_begin(list); item; item = type##_list_next(item))
-
-#define LIST_DEFINE_BEGIN(type) \
-static type* type##_list_begin(type* head) \
-{ \
-    while (head->next) { \
-        head = head->next; \
-    } \
-    return head; \
-}
-
-#define LIST_DEFINE_NEXT(type) static type* type##_list_next(type* head) { return head->prev; }
-
 
 // Atomic macros
 #ifdef _WIN32
 
 #define ATOMIC_HEADER_FILE <Windows.h>
 
+#define ATOMIC_READ_PTR(ptr) (InterlockedCompareExchangePointer((PVOID volatile*)&ptr, NULL, NULL))
+#define ATOMIC_EXCHANGE_PTR(ptr, new_value) (InterlockedExchangePointer((PVOID volatile*)&ptr, new_value))
+
 #if defined(_AMD64_) || defined(_M_X64) || defined(_M_ARM64)
 
 #define ATOMIC_COUNTER_TYPE LONG64
@@ -73,11 +63,36 @@ static type* type##_list_begin(type* head) \
 #define ATOMIC_ADD(value, add_value) (__sync_fetch_and_add((volatile unsigned int*)&value, add_value))
 #define ATOMIC_SUB(value, sub_value) (__sync_fetch_and_sub((volatile unsigned int*)&value, sub_value))
 
+#define ATOMIC_READ_PTR(ptr) (__atomic_load_n(&ptr, __ATOMIC_SEQ_CST))
+#define ATOMIC_EXCHANGE_PTR(ptr, new_value) (__atomic_exchange_n(&ptr, new_value, __ATOMIC_SEQ_CST))
+
 #endif
 
 
+typedef struct raid_buf {
+    const char* data;
+    size_t len;
+    bool zerocopy; // the caller's data outlives the send, so it can go with MSG_ZEROCOPY
+} raid_buf_t;
+
+
 void raid_reader_set_data(raid_reader_t* r, const char* data, size_t data_len, bool is_response);
 
+void raid_reader_init_pooled(raid_client_t* cl, raid_reader_t* r);
+
+void raid_reader_destroy_pooled(raid_client_t* cl, raid_reader_t* r);
+
+void raid_reader_pool_clear(raid_client_t* cl);
+
+
+void raid_writer_pool_clear(raid_client_t* cl);
+
+size_t raid_writer_num_segments(const raid_writer_t* w);
+
+// Size of the message as sent, including the data of binary references.
+size_t raid_writer_wire_size(const raid_writer_t* w);
+
+size_t raid_writer_segments(const raid_writer_t* w, raid_buf_t* bufs);
 
 raid_error_t raid_write_key_value_int(raid_writer_t* cl, const char* key, size_t key_len, int64_t n);
 
@@ -86,15 +101,101 @@ raid_error_t raid_write_key_value_float(raid_writer_t* cl, const char* key, size
 raid_error_t raid_write_key_value_string(raid_writer_t* cl, const char* key, size_t key_len, const char* str, size_t len);
 
 
-raid_error_t raid_socket_connect(raid_socket_t* s, const char* host, const char* port);
+// Like raid_reader_set_data, but takes ownership of the malloc'd data instead of copying it.
+void raid_reader_take_data(raid_reader_t* r, char* data, size_t data_len, bool is_response);
+
+// Like raid_reader_take_data, but the data is a mapping from raid_map_file.
+void raid_reader_take_mapped(raid_reader_t* r, char* data, size_t data_len, bool is_response);
+
+// Map the first len bytes of the file read-only, the mapping outlives the file.
+// Returns NULL if it can't be mapped.
+char* raid_map_file(FILE* f, size_t len);
+
+void raid_unmap(char* data, size_t len);
+
+// Make the reader an array of objects owned elsewhere, returns the items for the caller to fill.
+msgpack_object* raid_reader_set_array_view(raid_reader_t* r, size_t num_items);
+
+// Init a condition to be waited with raid_cond_wait_until, on the monotonic clock when available.
+int raid_cond_init(pthread_cond_t* cond);
+
+// Wait on a condition until signaled or the deadline on raid_clock_ms passes, returns false
+// if it already passed. RAID_NO_DEADLINE waits without a deadline.
+bool raid_cond_wait_until(pthread_cond_t* cond, pthread_mutex_t* mutex, int64_t deadline_ms);
+
+// Whether the action was registered as idempotent, reqs_mutex must be held.
+bool raid_is_idempotent_action_locked(raid_client_t* cl, const char* action, size_t action_len);
+
+// Fix the writer's internal pointers after it was moved in memory.
+void raid_writer_relocate(raid_writer_t* w);
+
+typedef struct raid_request_batch_item {
+    const raid_writer_t* writer;
+    void* user_data;
+    // Optional, points to the pending request until it's removed, guarded by reqs_mutex.
+    raid_request_t** handle;
+    int64_t deadline_ms; // on raid_clock_ms, or RAID_NO_DEADLINE
+} raid_request_batch_item_t;
+
+// Send many requests with a single lock acquisition and batched socket writes.
+raid_error_t raid_request_async_batch(raid_client_t* cl, const raid_request_batch_item_t* items, size_t num_items, raid_response_callback_t cb);
+
+// Remove the pending requests behind these handles in one pass, firing their callbacks with err.
+void raid_cancel_requests(raid_client_t* cl, raid_request_t** const* handles, size_t num_handles, raid_error_t err);
+
+
+// Hosts with this prefix are paths to unix domain sockets.
+#define RAID_UNIX_ADDRESS_PREFIX "unix:"
+
+#define raid_is_unix_address(host) (!strncmp((host), RAID_UNIX_ADDRESS_PREFIX, sizeof(RAID_UNIX_ADDRESS_PREFIX) - 1))
+
+// Hosts with this prefix are unix domain sockets to set up shared-memory rings through.
+#define RAID_SHM_ADDRESS_PREFIX "shm:"
+
+#define raid_is_shm_address(host) (!strncmp((host), RAID_SHM_ADDRESS_PREFIX, sizeof(RAID_SHM_ADDRESS_PREFIX) - 1))
+
+// Resolve through the process-wide address cache, the addresses are malloc'd for the caller.
+raid_error_t raid_resolve_cached(const char* host, const char* port, raid_address_t** out_addrs, size_t* out_num_addrs);
+
+// Expire the cached addresses of a host, so the next connect resolves it again.
+void raid_address_cache_invalidate(const char* host, const char* port);
+
+
+// Resolve with getaddrinfo, the addresses are malloc'd for the caller.
+raid_error_t raid_socket_resolve(const char* host, const char* port, raid_address_t** out_addrs, size_t* out_num_addrs);
+
+// Connect to the first of the addresses that answers, name is only used for logging.
+raid_error_t raid_socket_connect(raid_socket_t* s, const raid_address_t* addrs, size_t num_addrs, const char* name);
 
 bool raid_socket_connected(raid_socket_t* s);
 
 raid_error_t raid_socket_send(raid_socket_t* s, const char* data, size_t data_len);
 
+raid_error_t raid_socket_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs);
+
 raid_error_t raid_socket_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len);
 
+// Reap the zero-copy completions that arrived and return how many sends are still pending.
+// Never blocks, the socket must be guarded like a send.
+size_t raid_socket_zerocopy_pending(raid_socket_t* s);
+
 raid_error_t raid_socket_close(raid_socket_t* s);
 
 
+// Hand a pair of shared-memory rings to the peer listening on the unix socket path.
+raid_error_t raid_shm_connect(raid_socket_t* s, const char* path);
+
+// Listen for shared-memory clients on a unix socket path, for peers and tests.
+raid_error_t raid_shm_listen(const char* path, int* out_handle);
+
+// Accept a client's rings, after which s works like the client's end.
+raid_error_t raid_shm_accept(int listen_handle, raid_socket_t* s);
+
+raid_error_t raid_shm_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs);
+
+raid_error_t raid_shm_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len);
+
+raid_error_t raid_shm_close(raid_socket_t* s);
+
+
 #endif
@@ -1,6 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "raid.h"
+#include "raid_internal.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 void* raid_alloc(size_t size, const char* name)
 {
@@ -13,6 +18,17 @@ void* raid_alloc(size_t size, const char* name)
     return data;
 }
 
+void* raid_realloc(void* ptr, size_t size, const char* name)
+{
+    void* data = realloc(ptr, size);
+#ifdef RAID_DEBUG_MEM
+    fprintf(stderr, "[raid] %p realloc(%p, %zu): %s\n", data, ptr, size, name);
+#else
+    (void)name;
+#endif
+    return data;
+}
+
 void raid_dealloc(void* ptr, const char* name)
 {
 #ifdef RAID_DEBUG_MEM
@@ -24,3 +40,43 @@ void raid_dealloc(void* ptr, const char* name)
         free(ptr);
     }
 }
+
+#ifndef _WIN32
+
+char* raid_map_file(FILE* f, size_t len)
+{
+    if (!len || fflush(f) != 0) return NULL;
+
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (data == MAP_FAILED) return NULL;
+
+#ifdef MADV_SEQUENTIAL
+    // It's unpacked front to back.
+    madvise(data, len, MADV_SEQUENTIAL);
+#endif
+    return data;
+}
+
+void raid_unmap(char* data, size_t len)
+{
+    if (data) {
+        munmap(data, len);
+    }
+}
+
+#else
+
+char* raid_map_file(FILE* f, size_t len)
+{
+    (void)f;
+    (void)len;
+    return NULL;
+}
+
+void raid_unmap(char* data, size_t len)
+{
+    (void)data;
+    (void)len;
+}
+
+#endif
@@ -1,6 +1,25 @@
+#include <ctype.h>
 #include "raid.h"
 #include "raid_internal.h"
 
+// Maps with at least this many keys get a hash index on the first lookup.
+#define RAID_MAP_INDEX_THRESHOLD 16
+
+// Most indices kept per reader, the least recently used one is recycled.
+#define RAID_MAP_INDEX_CACHE_SIZE 4
+
+// Idle readers kept by each client.
+#define RAID_READER_POOL_SIZE 16
+
+// Readers that held more data than this are destroyed instead of pooled.
+#define RAID_READER_POOL_MAX_DATA (1024*1024)
+
+typedef struct raid_map_index {
+    const msgpack_object* map;
+    uint32_t mask;
+    uint32_t* slots; // entry index + 1, 0 means empty
+    struct raid_map_index* next;
+} raid_map_index_t;
 
 static msgpack_object* find_obj(msgpack_object* obj, const char* key)
 {
@@ -47,6 +66,176 @@ static void end_collection(raid_reader_t* r)
     r->nested = r->parents[r->nested_top];
 }
 
+static uint32_t hash_key(const char* key, size_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool key_equals(const msgpack_object* obj, const char* key, size_t len)
+{
+    return obj->type == MSGPACK_OBJECT_STR && obj->via.str.size == len && !memcmp(obj->via.str.ptr, key, len);
+}
+
+// Build the index into reuse when given, its slots are kept if they're big enough.
+static raid_map_index_t* build_map_index(raid_reader_t* r, const msgpack_object* map, raid_map_index_t* reuse)
+{
+    uint32_t num_slots = 1;
+    while (num_slots < map->via.map.size * 2) {
+        num_slots <<= 1;
+    }
+
+    raid_map_index_t* index = reuse;
+    if (index == NULL) {
+        index = msgpack_zone_malloc(r->mempool, sizeof(raid_map_index_t));
+        if (index == NULL) return NULL;
+        index->slots = NULL;
+        index->mask = 0;
+    }
+
+    if (index->slots == NULL || index->mask + 1 < num_slots) {
+        index->slots = msgpack_zone_malloc(r->mempool, sizeof(uint32_t) * num_slots);
+        if (index->slots == NULL) return NULL;
+    }
+
+    memset(index->slots, 0, sizeof(uint32_t) * num_slots);
+    index->map = map;
+    index->mask = num_slots - 1;
+
+    // Insert in reverse so the first occurrence of a duplicated key wins,
+    // same as a linear scan would.
+    for (uint32_t i = map->via.map.size; i > 0; i--) {
+        const msgpack_object* key = &map->via.map.ptr[i - 1].key;
+        if (key->type != MSGPACK_OBJECT_STR) continue;
+
+        uint32_t slot = hash_key(key->via.str.ptr, key->via.str.size) & index->mask;
+        while (index->slots[slot] != 0) {
+            const msgpack_object* other = &map->via.map.ptr[index->slots[slot] - 1].key;
+            if (key_equals(other, key->via.str.ptr, key->via.str.size)) break;
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = i;
+    }
+
+    return index;
+}
+
+static raid_map_index_t* get_map_index(raid_reader_t* r, const msgpack_object* map)
+{
+    raid_map_index_t* before_prev = NULL;
+    raid_map_index_t* prev = NULL;
+    raid_map_index_t* index = r->map_indices;
+    size_t num_indices = 0;
+    while (index) {
+        if (index->map == map) {
+            break;
+        }
+        before_prev = prev;
+        prev = index;
+        index = index->next;
+        num_indices++;
+    }
+
+    if (index == NULL) {
+        // Keep the list short, walking a long one would cost more than the scan it saves.
+        raid_map_index_t* reuse = NULL;
+        if (num_indices >= RAID_MAP_INDEX_CACHE_SIZE) {
+            reuse = prev;
+            if (before_prev) {
+                before_prev->next = NULL;
+            }
+            else {
+                r->map_indices = NULL;
+            }
+        }
+
+        index = build_map_index(r, map, reuse);
+        if (index == NULL) {
+            // The recycled index may be half built, leave it out.
+            return NULL;
+        }
+    }
+    else if (prev) {
+        prev->next = index->next;
+    }
+    else {
+        return index;
+    }
+
+    // Keep the most recently used index at the front, maps tend to be read one at a time.
+    index->next = r->map_indices;
+    r->map_indices = index;
+    return index;
+}
+
+static int find_map_key(raid_reader_t* r, const msgpack_object* map, const char* key, size_t len)
+{
+    if (map->via.map.size >= RAID_MAP_INDEX_THRESHOLD) {
+        raid_map_index_t* index = get_map_index(r, map);
+        if (index != NULL) {
+            uint32_t slot = hash_key(key, len) & index->mask;
+            while (index->slots[slot] != 0) {
+                uint32_t i = index->slots[slot] - 1;
+                if (key_equals(&map->via.map.ptr[i].key, key, len)) {
+                    return (int)i;
+                }
+                slot = (slot + 1) & index->mask;
+            }
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < map->via.map.size; i++) {
+        if (key_equals(&map->via.map.ptr[i].key, key, len)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool enter_map_key(raid_reader_t* r, const char* key, size_t len)
+{
+    if (!r->nested || r->nested->type != MSGPACK_OBJECT_MAP) return false;
+
+    int i = find_map_key(r, r->nested, key, len);
+    if (i < 0 || !begin_collection(r)) return false;
+
+    r->indices[r->nested_top - 1] = i;
+    r->nested = &parent(r)->via.map.ptr[i].val;
+    return true;
+}
+
+static bool enter_array_index(raid_reader_t* r, const char* key, size_t len)
+{
+    if (!r->nested || r->nested->type != MSGPACK_OBJECT_ARRAY || len == 0) return false;
+
+    size_t i = 0;
+    for (size_t k = 0; k < len; k++) {
+        if (!isdigit((unsigned char)key[k])) return false;
+        i = i*10 + (size_t)(key[k] - '0');
+        if (i >= r->nested->via.array.size) return false;
+    }
+    if (!begin_collection(r)) return false;
+
+    r->indices[r->nested_top - 1] = (int)i;
+    r->nested = &parent(r)->via.array.ptr[i];
+    return true;
+}
+
+static int path_depth(const char* path)
+{
+    int depth = 1;
+    for (const char* c = path; *c; c++) {
+        if (*c == '.') depth++;
+    }
+    return depth;
+}
+
 void raid_reader_init(raid_reader_t* r)
 {
     memset(r, 0, sizeof(raid_reader_t));
@@ -79,6 +268,20 @@ void raid_reader_init_with_data(raid_reader_t* r, const char* data, size_t data_
     raid_reader_set_data(r, data, data_len, false);
 }
 
+static void release_src_data(raid_reader_t* r)
+{
+    if (r->src_data_mapped) {
+        raid_unmap(r->src_data, r->src_data_len);
+    }
+    else {
+        raid_dealloc(r->src_data, "reader.src_data");
+    }
+    r->src_data = NULL;
+    r->src_data_len = 0;
+    r->src_data_cap = 0;
+    r->src_data_mapped = false;
+}
+
 void raid_reader_destroy(raid_reader_t* r)
 {
     if (r->mempool != NULL) {
@@ -88,9 +291,52 @@ void raid_reader_destroy(raid_reader_t* r)
     if (r->obj != NULL) {
         raid_dealloc(r->obj, "reader.obj");
     }
-    if (r->src_data) {
-        raid_dealloc(r->src_data, "reader.src_data");
+    release_src_data(r);
+}
+
+void raid_reader_init_pooled(raid_client_t* cl, raid_reader_t* r)
+{
+    pthread_mutex_lock(&cl->pool_mutex);
+    if (cl->reader_pool_len > 0) {
+        *r = cl->reader_pool[--cl->reader_pool_len];
+        pthread_mutex_unlock(&cl->pool_mutex);
+        return;
     }
+    pthread_mutex_unlock(&cl->pool_mutex);
+
+    raid_reader_init(r);
+}
+
+void raid_reader_destroy_pooled(raid_client_t* cl, raid_reader_t* r)
+{
+    if (r->src_data_cap <= RAID_READER_POOL_MAX_DATA) {
+        raid_reader_reset(r);
+
+        pthread_mutex_lock(&cl->pool_mutex);
+        if (cl->reader_pool == NULL) {
+            cl->reader_pool = raid_alloc(sizeof(raid_reader_t) * RAID_READER_POOL_SIZE, "reader_pool");
+        }
+        if (cl->reader_pool != NULL && cl->reader_pool_len < RAID_READER_POOL_SIZE) {
+            cl->reader_pool[cl->reader_pool_len++] = *r;
+            pthread_mutex_unlock(&cl->pool_mutex);
+            return;
+        }
+        pthread_mutex_unlock(&cl->pool_mutex);
+    }
+
+    raid_reader_destroy(r);
+}
+
+void raid_reader_pool_clear(raid_client_t* cl)
+{
+    pthread_mutex_lock(&cl->pool_mutex);
+    for (size_t i = 0; i < cl->reader_pool_len; i++) {
+        raid_reader_destroy(&cl->reader_pool[i]);
+    }
+    raid_dealloc(cl->reader_pool, "reader_pool");
+    cl->reader_pool = NULL;
+    cl->reader_pool_len = 0;
+    pthread_mutex_unlock(&cl->pool_mutex);
 }
 
 void raid_reader_swap(raid_reader_t* from, raid_reader_t* to)
@@ -100,34 +346,117 @@ void raid_reader_swap(raid_reader_t* from, raid_reader_t* to)
     *to = tmp;
 }
 
-void raid_reader_set_data(raid_reader_t* r, const char* data, size_t data_len, bool is_response)
+static void clear_position(raid_reader_t* r)
 {
-    if (!data || !data_len) return;
+    r->etag_obj = NULL;
+    r->action_obj = NULL;
+    r->header = NULL;
+    r->body = NULL;
+    r->nested = NULL;
+    r->nested_top = 0;
+    r->map_indices = NULL;
+}
 
-    if (r->src_data) {
-      raid_dealloc(r->src_data, "reader.src_data");
+void raid_reader_reset(raid_reader_t* r)
+{
+    clear_position(r);
+    if (r->src_data_mapped) {
+        release_src_data(r);
     }
+    r->src_data_len = 0;
+    r->obj->type = MSGPACK_OBJECT_NIL;
+    msgpack_zone_clear(r->mempool);
+}
 
-    // Copy the data because msgpack likes to hold pointers to our memory!!!!1
-    r->src_data = raid_alloc(sizeof(char)*data_len, "reader.src_data");
-    r->src_data_len = data_len;
-    memcpy(r->src_data, data, data_len);
-	
+static void unpack_data(raid_reader_t* r, bool is_response)
+{
     msgpack_zone_clear(r->mempool);
     msgpack_unpack(r->src_data, r->src_data_len, NULL, r->mempool, r->obj);
-    
+
     if (is_response) {
         r->body = r->nested = find_obj(r->obj, "body");
         r->header = find_obj(r->obj, "header");
         if (!r->header) return;
 
         r->etag_obj = find_obj(r->header, "etag");
+        r->action_obj = find_obj(r->header, "action");
+        if (r->action_obj && r->action_obj->type != MSGPACK_OBJECT_STR) {
+            r->action_obj = NULL;
+        }
     }
     else {
         r->body = r->nested = r->obj;
     }
 }
 
+void raid_reader_set_data(raid_reader_t* r, const char* data, size_t data_len, bool is_response)
+{
+    if (!data || !data_len) return;
+
+    clear_position(r);
+
+    // Copy the data because msgpack likes to hold pointers to our memory!!!!1
+    // Keep the previous buffer when it's big enough, readers get reused a lot.
+    if (r->src_data_cap < data_len || r->src_data_mapped) {
+        release_src_data(r);
+        r->src_data = raid_alloc(sizeof(char)*data_len, "reader.src_data");
+        r->src_data_cap = data_len;
+    }
+    r->src_data_len = data_len;
+    memcpy(r->src_data, data, data_len);
+
+    unpack_data(r, is_response);
+}
+
+void raid_reader_take_data(raid_reader_t* r, char* data, size_t data_len, bool is_response)
+{
+    if (!data || !data_len) {
+        raid_dealloc(data, "reader.src_data");
+        return;
+    }
+
+    clear_position(r);
+
+    release_src_data(r);
+    r->src_data = data;
+    r->src_data_len = data_len;
+    r->src_data_cap = data_len;
+
+    unpack_data(r, is_response);
+}
+
+void raid_reader_take_mapped(raid_reader_t* r, char* data, size_t data_len, bool is_response)
+{
+    clear_position(r);
+
+    // msgpack points into the mapping for strings and binaries, so they're never copied.
+    release_src_data(r);
+    r->src_data = data;
+    r->src_data_len = data_len;
+    r->src_data_mapped = true;
+
+    unpack_data(r, is_response);
+}
+
+msgpack_object* raid_reader_set_array_view(raid_reader_t* r, size_t num_items)
+{
+    raid_reader_reset(r);
+
+    msgpack_object* items = NULL;
+    if (num_items > 0) {
+        items = msgpack_zone_malloc(r->mempool, sizeof(msgpack_object) * num_items);
+        if (items == NULL) {
+            return NULL;
+        }
+    }
+
+    r->obj->type = MSGPACK_OBJECT_ARRAY;
+    r->obj->via.array.size = (uint32_t)num_items;
+    r->obj->via.array.ptr = items;
+    r->body = r->nested = r->obj;
+    return items;
+}
+
 bool raid_is_invalid(raid_reader_t* r)
 {
     return raid_read_type(r) == RAID_INVALID;
@@ -186,45 +515,65 @@ bool raid_is_code(raid_reader_t* r, const char* code)
 }
 
 bool raid_read_code(raid_reader_t* r, char** res, size_t* len)
+{
+    const char* ptr = NULL;
+    if (!raid_read_code_view(r, &ptr, len)) return false;
+
+    *res = malloc(*len);
+    memcpy(*res, ptr, *len);
+    return true;
+}
+
+bool raid_read_code_view(raid_reader_t* r, const char** res, size_t* len)
 {
     if (!r->header) return false;
 
     for (size_t i = 0; i < r->header->via.map.size; i++) {
-        const char* ptr = r->header->via.map.ptr[i].val.via.str.ptr;
-        size_t size = r->header->via.map.ptr[i].val.via.str.size;
         if (!strncmp("code", r->header->via.map.ptr[i].key.via.str.ptr, 4)) {
-            *res = malloc(size);
-            *len = size;
-            memcpy(*res, ptr, size);
+            *res = r->header->via.map.ptr[i].val.via.str.ptr;
+            *len = r->header->via.map.ptr[i].val.via.str.size;
             return true;
         }
     }
     return false;
 }
 
+bool raid_read_action_view(raid_reader_t* r, const char** res, size_t* len)
+{
+    if (!r->action_obj) return false;
+
+    *res = r->action_obj->via.str.ptr;
+    *len = r->action_obj->via.str.size;
+    return true;
+}
+
 bool raid_read_code_cstring(raid_reader_t* r, char** res)
 {
-    if (!r->header) return false;
+    const char* ptr = NULL;
+    size_t size = 0;
+    if (!raid_read_code_view(r, &ptr, &size)) return false;
 
-    for (size_t i = 0; i < r->header->via.map.size; i++) {
-        const char* ptr = r->header->via.map.ptr[i].val.via.str.ptr;
-        size_t size = r->header->via.map.ptr[i].val.via.str.size;
-        if (!strncmp("code", r->header->via.map.ptr[i].key.via.str.ptr, 4)) {
-            *res = malloc(size+1);
-            memcpy(*res, ptr, size);
-            (*res)[size] = '\0';
-            return true;
-        }
-    }
-    return false;
+    *res = malloc(size+1);
+    memcpy(*res, ptr, size);
+    (*res)[size] = '\0';
+    return true;
 }
 
-bool raid_read_etag_cstring(raid_reader_t* r, char** res)
+bool raid_read_etag_view(raid_reader_t* r, const char** res, size_t* len)
 {
     if (!r->etag_obj) return false;
 
-    const char* ptr = r->etag_obj->via.str.ptr;
-    size_t size = r->etag_obj->via.str.size;
+    *res = r->etag_obj->via.str.ptr;
+    *len = r->etag_obj->via.str.size;
+    return true;
+}
+
+bool raid_read_etag_cstring(raid_reader_t* r, char** res)
+{
+    const char* ptr = NULL;
+    size_t size = 0;
+    if (!raid_read_etag_view(r, &ptr, &size)) return false;
+
     *res = malloc(size+1);
     memcpy(*res, ptr, size);
     (*res)[size] = '\0';
@@ -298,43 +647,104 @@ bool raid_read_float(raid_reader_t* r, double* res)
     return true;
 }
 
+bool raid_read_int_array(raid_reader_t* r, int64_t* out, size_t n, size_t* len)
+{
+    if (!r->nested || !len) return false;
+
+    if (r->nested->type != MSGPACK_OBJECT_ARRAY)
+        return false;
+
+    const msgpack_object* items = r->nested->via.array.ptr;
+    size_t count = r->nested->via.array.size;
+    if (count > n) {
+        count = n;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].type != MSGPACK_OBJECT_POSITIVE_INTEGER && items[i].type != MSGPACK_OBJECT_NEGATIVE_INTEGER)
+            return false;
+
+        out[i] = items[i].via.i64;
+    }
+
+    *len = r->nested->via.array.size;
+    return true;
+}
+
+bool raid_read_float_array(raid_reader_t* r, double* out, size_t n, size_t* len)
+{
+    if (!r->nested || !len) return false;
+
+    if (r->nested->type != MSGPACK_OBJECT_ARRAY)
+        return false;
+
+    const msgpack_object* items = r->nested->via.array.ptr;
+    size_t count = r->nested->via.array.size;
+    if (count > n) {
+        count = n;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].type != MSGPACK_OBJECT_FLOAT && items[i].type != MSGPACK_OBJECT_FLOAT32)
+            return false;
+
+        out[i] = items[i].via.f64;
+    }
+
+    *len = r->nested->via.array.size;
+    return true;
+}
+
 bool raid_read_binary(raid_reader_t* r, char** res, size_t* len)
+{
+    const char* ptr = NULL;
+    if (!raid_read_binary_view(r, &ptr, len)) return false;
+
+    *res = malloc(*len);
+    memcpy(*res, ptr, *len);
+    return true;
+}
+
+bool raid_read_binary_view(raid_reader_t* r, const char** res, size_t* len)
 {
     if (!r->nested) return false;
 
     if (r->nested->type != MSGPACK_OBJECT_BIN)
         return false;
 
-    const char* ptr = r->nested->via.bin.ptr;
+    *res = r->nested->via.bin.ptr;
     *len = r->nested->via.bin.size;
+    return true;
+}
+
+bool raid_read_string(raid_reader_t* r, char** res, size_t* len)
+{
+    const char* ptr = NULL;
+    if (!raid_read_string_view(r, &ptr, len)) return false;
+
     *res = malloc(*len);
     memcpy(*res, ptr, *len);
     return true;
 }
 
-bool raid_read_string(raid_reader_t* r, char** res, size_t* len)
+bool raid_read_string_view(raid_reader_t* r, const char** res, size_t* len)
 {
     if (!r->nested) return false;
 
     if (r->nested->type != MSGPACK_OBJECT_STR && r->nested->type != MSGPACK_OBJECT_BIN)
         return false;
 
-    const char* ptr = r->nested->via.str.ptr;
+    *res = r->nested->via.str.ptr;
     *len = r->nested->via.str.size;
-    *res = malloc(*len);
-    memcpy(*res, ptr, *len);
     return true;
 }
 
 bool raid_read_cstring(raid_reader_t* r, char** res)
 {
-    if (!r->nested) return false;
+    const char* ptr = NULL;
+    size_t len = 0;
+    if (!raid_read_string_view(r, &ptr, &len)) return false;
 
-    if (r->nested->type != MSGPACK_OBJECT_STR && r->nested->type != MSGPACK_OBJECT_BIN)
-        return false;
-
-    const char* ptr = r->nested->via.str.ptr;
-    size_t len = r->nested->via.str.size;
     *res = malloc(len + 1);
     memcpy(*res, ptr, len);
     (*res)[len] = '\0';
@@ -360,20 +770,15 @@ bool raid_copy_cstring(raid_reader_t* r, char* buf, size_t buf_len)
 
 bool raid_read_map_key(raid_reader_t* r, char** key, size_t* len)
 {
-    if (!r->nested) return false;
+    const char* ptr = NULL;
+    if (!raid_read_map_key_view(r, &ptr, len)) return false;
 
-    if (!parent(r) || parent(r)->type != MSGPACK_OBJECT_MAP)
-        return false;
-
-    msgpack_object* obj = &parent(r)->via.map.ptr[current_index(r)].key;
-    const char* ptr = obj->via.str.ptr;
-    *len = obj->via.str.size;
     *key = malloc(*len);
     memcpy(*key, ptr, *len);
     return true;
 }
 
-bool raid_read_map_key_cstring(raid_reader_t* r, char** key)
+bool raid_read_map_key_view(raid_reader_t* r, const char** key, size_t* len)
 {
     if (!r->nested) return false;
 
@@ -381,8 +786,16 @@ bool raid_read_map_key_cstring(raid_reader_t* r, char** key)
         return false;
 
     msgpack_object* obj = &parent(r)->via.map.ptr[current_index(r)].key;
-    const char* ptr = obj->via.str.ptr;
-    size_t size = obj->via.str.size;
+    *key = obj->via.str.ptr;
+    *len = obj->via.str.size;
+    return true;
+}
+
+bool raid_read_map_key_cstring(raid_reader_t* r, char** key)
+{
+    const char* ptr = NULL;
+    size_t size = 0;
+    if (!raid_read_map_key_view(r, &ptr, &size)) return false;
 
     *key = malloc(size+1);
     memcpy(*key, ptr, size);
@@ -470,3 +883,52 @@ bool raid_read_next(raid_reader_t* r)
     }
     return false;
 }
+
+bool raid_read_map_get(raid_reader_t* r, const char* key)
+{
+    if (!key) return false;
+
+    return enter_map_key(r, key, strlen(key));
+}
+
+bool raid_read_path(raid_reader_t* r, const char* path)
+{
+    if (!path) return false;
+
+    int depth = 0;
+    const char* c = path;
+    while (true) {
+        const char* end = strchr(c, '.');
+        size_t len = end ? (size_t)(end - c) : strlen(c);
+
+        bool ok = false;
+        if (r->nested && r->nested->type == MSGPACK_OBJECT_ARRAY) {
+            ok = enter_array_index(r, c, len);
+        }
+        else {
+            ok = enter_map_key(r, c, len);
+        }
+
+        if (!ok) {
+            // Leave the reader where it was.
+            while (depth-- > 0) {
+                end_collection(r);
+            }
+            return false;
+        }
+
+        depth++;
+        if (!end) break;
+        c = end + 1;
+    }
+    return true;
+}
+
+void raid_read_end_path(raid_reader_t* r, const char* path)
+{
+    if (!r->nested || !path) return;
+
+    for (int depth = path_depth(path); depth > 0; depth--) {
+        end_collection(r);
+    }
+}
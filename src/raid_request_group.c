@@ -1,30 +1,40 @@
 #include "raid.h"
 #include "raid_internal.h"
 
-LIST_DEFINE_BEGIN(raid_request_group_entry_t)
-LIST_DEFINE_NEXT(raid_request_group_entry_t)
+// Entries allocated by the first add when no capacity is given.
+#define RAID_REQUEST_GROUP_MIN_CAPACITY 8
 
 void raid_request_group_init(raid_request_group_t* g, raid_client_t* raid)
 {
     memset(g, 0, sizeof(raid_request_group_t));
     g->raid = raid;
+    g->deadline_ms = RAID_NO_DEADLINE;
     pthread_mutex_init(&g->entries_mutex, NULL);
-    pthread_cond_init(&g->entries_cond, NULL);
+    raid_cond_init(&g->entries_cond);
 }
 
 void raid_request_group_destroy(raid_request_group_t* g)
 {
-    raid_request_group_entry_t* entry = g->entries;
-    while (entry) {
+    if (g->ready != NULL) {
+        // Don't leave pending requests pointing at the entries.
+        raid_request_group_cancel(g);
+        raid_request_group_wait(g);
+    }
+
+    for (size_t i = 0; i < g->num_entries; i++) {
+        raid_request_group_entry_t* entry = &g->entries[i];
         raid_writer_destroy(&entry->writer);
-        raid_reader_destroy(&entry->reader);
-        raid_request_group_entry_t* next = entry->next;
-        free(entry);
-        entry = next;
+        raid_reader_destroy_pooled(g->raid, &entry->reader);
     }
+    free(g->entries);
+    free(g->ready);
     g->entries = NULL;
+    g->ready = NULL;
+    g->ready_pos = 0;
+    g->entries_cap = 0;
     g->num_entries = 0;
     g->num_entries_done = 0;
+    g->num_entries_sent = 0;
 }
 
 raid_request_group_t* raid_request_group_new(raid_client_t* raid)
@@ -34,24 +44,71 @@ raid_request_group_t* raid_request_group_new(raid_client_t* raid)
     return g;
 }
 
+raid_request_group_t* raid_request_group_new_with_capacity(raid_client_t* raid, size_t capacity)
+{
+    raid_request_group_t* g = raid_request_group_new(raid);
+    raid_request_group_reserve(g, capacity);
+    return g;
+}
+
 void raid_request_group_delete(raid_request_group_t* g)
 {
     raid_request_group_destroy(g);
     free(g);
 }
 
+// Whether requests sent by the group might still point at its entries.
+static bool has_pending_requests(raid_request_group_t* g)
+{
+    pthread_mutex_lock(&g->entries_mutex);
+    bool pending = g->num_entries_done < g->num_entries_sent;
+    pthread_mutex_unlock(&g->entries_mutex);
+    return pending;
+}
+
+bool raid_request_group_reserve(raid_request_group_t* g, size_t capacity)
+{
+    if (capacity <= g->entries_cap) {
+        return true;
+    }
+    if (has_pending_requests(g)) {
+        return false;
+    }
+
+    raid_request_group_entry_t* entries = realloc(g->entries, sizeof(raid_request_group_entry_t) * capacity);
+    if (entries == NULL) {
+        return false;
+    }
+
+    // The writers point into themselves, fix them up after the move.
+    g->entries = entries;
+    g->entries_cap = capacity;
+    for (size_t i = 0; i < g->num_entries; i++) {
+        raid_writer_relocate(&g->entries[i].writer);
+    }
+    return true;
+}
+
 raid_request_group_entry_t* raid_request_group_add(raid_request_group_t* g)
 {
-    raid_request_group_entry_t* entry = malloc(sizeof(raid_request_group_entry_t));
-    if (entry == NULL) {
+    if (has_pending_requests(g)) {
         return NULL;
     }
+    if (g->num_entries == g->entries_cap) {
+        size_t capacity = g->entries_cap * 2;
+        if (capacity < RAID_REQUEST_GROUP_MIN_CAPACITY) {
+            capacity = RAID_REQUEST_GROUP_MIN_CAPACITY;
+        }
+        if (!raid_request_group_reserve(g, capacity)) {
+            return NULL;
+        }
+    }
 
+    raid_request_group_entry_t* entry = &g->entries[g->num_entries];
     memset(entry, 0, sizeof(raid_request_group_entry_t));
     entry->group = g;
     raid_writer_init(&entry->writer, g->raid);
-    raid_reader_init(&entry->reader);
-    LIST_APPEND(g->entries, entry);
+    raid_reader_init_pooled(g->raid, &entry->reader);
     g->num_entries++;
     return entry;
 }
@@ -68,38 +125,154 @@ static void request_group_response_callback(raid_client_t* cl, raid_reader_t* r,
     }
 
     // Notify this request entry is done.
-    pthread_mutex_lock(&entry->group->entries_mutex);
-    entry->group->num_entries_done += 1;
-    pthread_cond_signal(&entry->group->entries_cond);
-    pthread_mutex_unlock(&entry->group->entries_mutex);
+    raid_request_group_t* g = entry->group;
+    pthread_mutex_lock(&g->entries_mutex);
+    g->ready[g->num_entries_done++] = (size_t)(entry - g->entries);
+    pthread_cond_broadcast(&g->entries_cond);
+    pthread_mutex_unlock(&g->entries_mutex);
+}
+
+static void cancel_pending(raid_request_group_t* g, raid_error_t err)
+{
+    if (g->num_entries == 0) {
+        return;
+    }
+
+    raid_request_t*** handles = malloc(sizeof(raid_request_t**) * g->num_entries);
+    for (size_t i = 0; i < g->num_entries; i++) {
+        handles[i] = &g->entries[i].request;
+    }
+    raid_cancel_requests(g->raid, (raid_request_t** const*)handles, g->num_entries, err);
+    free(handles);
+}
+
+// Wait for an entry to be done, returns false if the deadline passed.
+// Expires the pending requests once the group's own deadline passes.
+static bool group_cond_wait(raid_request_group_t* g, int64_t deadline_ms)
+{
+    bool group_deadline = false;
+    if (g->deadline_ms >= 0 && !g->deadline_expired && (deadline_ms < 0 || g->deadline_ms < deadline_ms)) {
+        deadline_ms = g->deadline_ms;
+        group_deadline = true;
+    }
+
+    if (raid_cond_wait_until(&g->entries_cond, &g->entries_mutex, deadline_ms)) {
+        return true;
+    }
+    if (!group_deadline) {
+        return false;
+    }
+
+    // The callbacks take the entries mutex, let go of it while expiring.
+    g->deadline_expired = true;
+    pthread_mutex_unlock(&g->entries_mutex);
+    cancel_pending(g, RAID_RECV_TIMEOUT);
+    pthread_mutex_lock(&g->entries_mutex);
+    return true;
 }
 
 raid_error_t raid_request_group_send(raid_request_group_t* g)
 {
-    raid_error_t result = RAID_SUCCESS;
-    LIST_FOREACH(raid_request_group_entry_t, entry, g->entries) {
-        result = raid_request_async(g->raid, &entry->writer, request_group_response_callback, (void*)entry);
-        if (result != RAID_SUCCESS) {
-            break;
-        }
+    if (g->num_entries == 0) {
+        return RAID_SUCCESS;
+    }
+    // The callbacks of the previous send still write into ready.
+    if (has_pending_requests(g)) {
+        return RAID_INVALID_ARGUMENT;
     }
+
+    free(g->ready);
+    g->ready = malloc(sizeof(size_t) * g->num_entries);
+    g->ready_pos = 0;
+    g->num_entries_done = 0;
+    g->num_entries_sent = g->num_entries;
+    g->deadline_expired = false;
+
+    raid_request_batch_item_t* items = malloc(sizeof(raid_request_batch_item_t) * g->num_entries);
+    for (size_t i = 0; i < g->num_entries; i++) {
+        items[i].writer = &g->entries[i].writer;
+        items[i].user_data = &g->entries[i];
+        items[i].handle = &g->entries[i].request;
+        items[i].deadline_ms = g->deadline_ms;
+    }
+
+    // Register and send all the requests at once.
+    raid_error_t result = raid_request_async_batch(g->raid, items, g->num_entries, request_group_response_callback);
     if (result != RAID_SUCCESS) {
-        // If an error occurs sending any of the requests, cancel the entire group.
-        LIST_FOREACH(raid_request_group_entry_t, entry, g->entries) {
-            raid_cancel_request(g->raid, entry->writer.etag);
+        // None of the requests were registered, fail the entire group.
+        for (size_t i = 0; i < g->num_entries; i++) {
+            g->entries[i].error = result;
+            g->ready[i] = i;
         }
         g->num_entries_done = g->num_entries;
     }
+
+    free(items);
     return result;
 }
 
+void raid_request_group_cancel(raid_request_group_t* g)
+{
+    cancel_pending(g, RAID_CANCELED);
+}
+
+void raid_request_group_set_deadline(raid_request_group_t* g, int64_t deadline_ms)
+{
+    g->deadline_ms = deadline_ms;
+}
+
 void raid_request_group_wait(raid_request_group_t* g)
 {
+    raid_request_group_wait_quorum(g, g->num_entries, RAID_NO_DEADLINE);
+}
+
+bool raid_request_group_wait_until(raid_request_group_t* g, int64_t deadline_ms)
+{
+    return raid_request_group_wait_quorum(g, g->num_entries, deadline_ms);
+}
+
+bool raid_request_group_wait_quorum(raid_request_group_t* g, size_t count, int64_t deadline_ms)
+{
+    // Entries added after the last send have nothing to wait for.
+    if (count > g->num_entries_sent) {
+        count = g->num_entries_sent;
+    }
+
+    pthread_mutex_lock(&g->entries_mutex);
+    bool done = true;
+    while (g->num_entries_done < count) {
+        if (!group_cond_wait(g, deadline_ms)) {
+            done = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g->entries_mutex);
+    return done;
+}
+
+raid_request_group_entry_t* raid_request_group_next_ready(raid_request_group_t* g)
+{
+    raid_request_group_entry_t* entry = NULL;
+    pthread_mutex_lock(&g->entries_mutex);
+    if (g->ready_pos < g->num_entries_done) {
+        entry = &g->entries[g->ready[g->ready_pos++]];
+    }
+    pthread_mutex_unlock(&g->entries_mutex);
+    return entry;
+}
+
+raid_request_group_entry_t* raid_request_group_wait_any(raid_request_group_t* g)
+{
+    raid_request_group_entry_t* entry = NULL;
     pthread_mutex_lock(&g->entries_mutex);
-    while (g->num_entries_done < g->num_entries) {
-        pthread_cond_wait(&g->entries_cond, &g->entries_mutex);
+    while (g->ready_pos == g->num_entries_done && g->num_entries_done < g->num_entries_sent) {
+        group_cond_wait(g, RAID_NO_DEADLINE);
+    }
+    if (g->ready_pos < g->num_entries_done) {
+        entry = &g->entries[g->ready[g->ready_pos++]];
     }
     pthread_mutex_unlock(&g->entries_mutex);
+    return entry;
 }
 
 raid_error_t raid_request_group_send_and_wait(raid_request_group_t* g)
@@ -111,30 +284,57 @@ raid_error_t raid_request_group_send_and_wait(raid_request_group_t* g)
     return err;
 }
 
+static raid_error_t* collect_errors(raid_request_group_t* g)
+{
+    raid_error_t* errs = malloc(sizeof(raid_error_t) * g->num_entries);
+    for (size_t i = 0; i < g->num_entries; i++) {
+        errs[i] = g->entries[i].error;
+    }
+    return errs;
+}
+
 void raid_request_group_read_to_array(raid_request_group_t* g, raid_reader_t* out_reader, raid_error_t** out_errs)
 {
     raid_writer_t aw;
     raid_writer_init(&aw, g->raid);
     raid_write_array(&aw, g->num_entries);
 
-    if (out_errs != NULL) {
-        *out_errs = malloc(sizeof(raid_error_t) * g->num_entries);
-    }
-
-    size_t i = 0;
-    LIST_FOREACH(raid_request_group_entry_t, entry, g->entries) {
+    for (size_t i = 0; i < g->num_entries; i++) {
+        const raid_request_group_entry_t* entry = &g->entries[i];
         if (entry->reader.body) {
             raid_write_object(&aw, entry->reader.body);
         }
         else {
             raid_write_nil(&aw);
         }
-        if (out_errs != NULL) {
-            (*out_errs)[i] = entry->error;
-        }
-        i++;
     }
 
-    raid_reader_set_data(out_reader, raid_writer_data(&aw), raid_writer_size(&aw), false);
+    if (out_errs != NULL) {
+        *out_errs = collect_errors(g);
+    }
+
+    // Hand the writer's buffer to the reader instead of copying it.
+    size_t size = aw.sbuf.size;
+    raid_reader_take_data(out_reader, msgpack_sbuffer_release(&aw.sbuf), size, false);
     raid_writer_destroy(&aw);
 }
+
+void raid_request_group_read_to_array_view(raid_request_group_t* g, raid_reader_t* out_reader, raid_error_t** out_errs)
+{
+    msgpack_object* items = raid_reader_set_array_view(out_reader, g->num_entries);
+    if (items != NULL) {
+        for (size_t i = 0; i < g->num_entries; i++) {
+            const raid_request_group_entry_t* entry = &g->entries[i];
+            if (entry->reader.body) {
+                items[i] = *entry->reader.body;
+            }
+            else {
+                items[i].type = MSGPACK_OBJECT_NIL;
+            }
+        }
+    }
+
+    if (out_errs != NULL) {
+        *out_errs = collect_errors(g);
+    }
+}
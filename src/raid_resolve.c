@@ -0,0 +1,218 @@
+#include "raid.h"
+#include "raid_internal.h"
+
+#define RAID_ADDRESS_CACHE_TTL_DEFAULT_MS (60*1000)
+
+typedef struct address_cache_entry {
+    char* host;
+    char* port;
+    raid_address_t* addrs;
+    size_t num_addrs;
+    int64_t expires_at;
+    raid_error_t err; // result of the last lookup
+    unsigned int generation; // bumped every time a lookup finishes
+    bool resolving;
+    size_t num_waiters;
+    struct address_cache_entry* next;
+} address_cache_entry_t;
+
+typedef struct {
+    char* host;
+    char* port;
+} resolve_task_t;
+
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cache_cond = PTHREAD_COND_INITIALIZER;
+static address_cache_entry_t* g_cache;
+static int64_t g_cache_ttl_ms = RAID_ADDRESS_CACHE_TTL_DEFAULT_MS;
+
+static address_cache_entry_t* find_entry(const char* host, const char* port)
+{
+    for (address_cache_entry_t* e = g_cache; e; e = e->next) {
+        if (!strcmp(e->host, host) && !strcmp(e->port, port)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static address_cache_entry_t* add_entry(const char* host, const char* port)
+{
+    address_cache_entry_t* e = calloc(1, sizeof(address_cache_entry_t));
+    if (!e) {
+        return NULL;
+    }
+    e->host = strdup(host);
+    e->port = strdup(port);
+    if (!e->host || !e->port) {
+        free(e->host);
+        free(e->port);
+        free(e);
+        return NULL;
+    }
+    e->next = g_cache;
+    g_cache = e;
+    return e;
+}
+
+static raid_error_t copy_addresses(const address_cache_entry_t* e, raid_address_t** out_addrs, size_t* out_num_addrs)
+{
+    raid_address_t* addrs = malloc(e->num_addrs * sizeof(raid_address_t));
+    if (!addrs) {
+        return RAID_UNKNOWN;
+    }
+    memcpy(addrs, e->addrs, e->num_addrs * sizeof(raid_address_t));
+    *out_addrs = addrs;
+    *out_num_addrs = e->num_addrs;
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_resolve_cached(const char* host, const char* port, raid_address_t** out_addrs, size_t* out_num_addrs)
+{
+    if (raid_is_unix_address(host)) {
+        // Nothing to look up.
+        return raid_socket_resolve(host, port, out_addrs, out_num_addrs);
+    }
+
+    pthread_mutex_lock(&g_cache_mutex);
+    if (g_cache_ttl_ms <= 0) {
+        pthread_mutex_unlock(&g_cache_mutex);
+        return raid_socket_resolve(host, port, out_addrs, out_num_addrs);
+    }
+
+    address_cache_entry_t* e = find_entry(host, port);
+    if (!e) {
+        e = add_entry(host, port);
+        if (!e) {
+            pthread_mutex_unlock(&g_cache_mutex);
+            return RAID_UNKNOWN;
+        }
+    }
+
+    raid_error_t err = RAID_SUCCESS;
+    if (e->resolving) {
+        // Someone is resolving this host already, take their result.
+        unsigned int generation = e->generation;
+        e->num_waiters++;
+        while (e->generation == generation) {
+            pthread_cond_wait(&g_cache_cond, &g_cache_mutex);
+        }
+        e->num_waiters--;
+        err = e->err == RAID_SUCCESS ? copy_addresses(e, out_addrs, out_num_addrs) : e->err;
+        pthread_mutex_unlock(&g_cache_mutex);
+        return err;
+    }
+    if (e->num_addrs > 0 && raid_clock_ms() < e->expires_at) {
+        err = copy_addresses(e, out_addrs, out_num_addrs);
+        pthread_mutex_unlock(&g_cache_mutex);
+        return err;
+    }
+
+    // Resolve without the lock, other hosts can still be looked up meanwhile.
+    e->resolving = true;
+    pthread_mutex_unlock(&g_cache_mutex);
+
+    raid_address_t* addrs = NULL;
+    size_t num_addrs = 0;
+    err = raid_socket_resolve(host, port, &addrs, &num_addrs);
+
+    pthread_mutex_lock(&g_cache_mutex);
+    free(e->addrs);
+    e->addrs = addrs;
+    e->num_addrs = num_addrs;
+    e->err = err;
+    e->expires_at = raid_clock_ms() + g_cache_ttl_ms;
+    e->resolving = false;
+    e->generation++;
+    pthread_cond_broadcast(&g_cache_cond);
+    if (err == RAID_SUCCESS) {
+        err = copy_addresses(e, out_addrs, out_num_addrs);
+    }
+    pthread_mutex_unlock(&g_cache_mutex);
+    return err;
+}
+
+void raid_address_cache_invalidate(const char* host, const char* port)
+{
+    pthread_mutex_lock(&g_cache_mutex);
+    address_cache_entry_t* e = find_entry(host, port);
+    if (e) {
+        e->expires_at = 0;
+    }
+    pthread_mutex_unlock(&g_cache_mutex);
+}
+
+void raid_set_address_cache_ttl(int64_t ttl_ms)
+{
+    pthread_mutex_lock(&g_cache_mutex);
+    g_cache_ttl_ms = ttl_ms;
+    pthread_mutex_unlock(&g_cache_mutex);
+}
+
+void raid_clear_address_cache()
+{
+    pthread_mutex_lock(&g_cache_mutex);
+    address_cache_entry_t** link = &g_cache;
+    while (*link) {
+        address_cache_entry_t* e = *link;
+        if (e->resolving || e->num_waiters > 0) {
+            // Still in use, only make sure its addresses aren't reused.
+            e->expires_at = 0;
+            link = &e->next;
+            continue;
+        }
+        *link = e->next;
+        free(e->addrs);
+        free(e->host);
+        free(e->port);
+        free(e);
+    }
+    pthread_mutex_unlock(&g_cache_mutex);
+}
+
+static void* resolve_thread(void* arg)
+{
+    resolve_task_t* task = (resolve_task_t*)arg;
+    raid_address_t* addrs = NULL;
+    size_t num_addrs = 0;
+    if (raid_resolve_cached(task->host, task->port, &addrs, &num_addrs) == RAID_SUCCESS) {
+        free(addrs);
+    }
+    free(task->host);
+    free(task->port);
+    free(task);
+    return NULL;
+}
+
+raid_error_t raid_resolve_async(raid_client_t* cl)
+{
+    if (raid_is_shm_address(cl->host)) {
+        // Not resolved, see connect_socket.
+        return RAID_SUCCESS;
+    }
+
+    resolve_task_t* task = malloc(sizeof(resolve_task_t));
+    if (!task) {
+        return RAID_UNKNOWN;
+    }
+    task->host = strdup(cl->host);
+    task->port = strdup(cl->port);
+    if (!task->host || !task->port) {
+        free(task->host);
+        free(task->port);
+        free(task);
+        return RAID_UNKNOWN;
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, &resolve_thread, (void*)task);
+    if (err != 0) {
+        fprintf(stderr, "Cannot create thread: %s\n", strerror(err));
+        free(task->host);
+        free(task->port);
+        free(task);
+        return RAID_UNKNOWN;
+    }
+    pthread_detach(thread);
+    return RAID_SUCCESS;
+}
@@ -0,0 +1,632 @@
+#include "raid.h"
+#include "raid_internal.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#define RAID_SHM_MAGIC 0x44494152 // "RAID"
+#define RAID_SHM_VERSION 1
+
+// Bytes in each direction, must be a power of two.
+#define RAID_SHM_RING_SIZE (1 << 20)
+
+// Control blocks live in the first page, the ring data after it.
+#define RAID_SHM_HEADER_SIZE 4096
+
+// Sent back and forth over the unix socket to set up the rings.
+#define RAID_SHM_HELLO 'R'
+
+// A byte stream in one direction: only the producer writes head and only
+// the consumer writes tail, on separate cache lines.
+typedef struct {
+    uint64_t head; // bytes written since the start
+    char pad0[56];
+    uint64_t tail; // bytes read since the start
+    char pad1[56];
+    uint32_t consumer_waiting;
+    uint32_t producer_waiting;
+    char pad2[56];
+} shm_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    char pad[48];
+    shm_ring_t rings[2]; // client to peer, then peer to client
+} shm_header_t;
+
+// Eventfds passed to the peer, a "data" and a "space" doorbell for each ring.
+enum {
+    SHM_FD_MEMORY,
+    SHM_FD_C2P_DATA,
+    SHM_FD_C2P_SPACE,
+    SHM_FD_P2C_DATA,
+    SHM_FD_P2C_SPACE,
+    SHM_NUM_FDS,
+};
+
+// The peer can write anywhere in the mapping, so only what we validated or own
+// is kept here, and what we read from the rings is checked before use.
+struct raid_shm {
+    shm_header_t* header;
+    size_t map_size;
+    uint64_t ring_size;
+    uint64_t tx_head; // our copy of tx->head, only we write it
+    uint64_t rx_tail; // our copy of rx->tail, only we write it
+    shm_ring_t* tx;
+    char* tx_data;
+    shm_ring_t* rx;
+    char* rx_data;
+    int tx_data_fd; // rung after writing to tx
+    int tx_space_fd; // waited on when tx is full
+    int rx_data_fd; // waited on when rx is empty
+    int rx_space_fd; // rung after reading from rx
+    int fds[SHM_NUM_FDS - 1];
+    int closed; // wakes up and fails the waiters
+};
+
+static void shm_free(struct raid_shm* shm)
+{
+    if (shm->header) {
+        munmap(shm->header, shm->map_size);
+    }
+    for (int i = 0; i < SHM_NUM_FDS - 1; i++) {
+        if (shm->fds[i] != -1) {
+            close(shm->fds[i]);
+        }
+    }
+    free(shm);
+}
+
+static void close_fds(const int* fds, size_t num_fds)
+{
+    for (size_t i = 0; i < num_fds; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+}
+
+// Map the rings and pick our side of them, takes ownership of the eventfds even on failure.
+static struct raid_shm* shm_new(int memory_fd, const int* event_fds, bool is_peer)
+{
+    struct raid_shm* shm = calloc(1, sizeof(struct raid_shm));
+    if (!shm) {
+        close_fds(event_fds, SHM_NUM_FDS - 1);
+        return NULL;
+    }
+    memcpy(shm->fds, event_fds, sizeof(shm->fds));
+
+    struct stat st;
+    if (fstat(memory_fd, &st) == -1 || (size_t)st.st_size < RAID_SHM_HEADER_SIZE) {
+        shm_free(shm);
+        return NULL;
+    }
+    shm->map_size = (size_t)st.st_size;
+    void* addr = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+    if (addr == MAP_FAILED) {
+        shm_free(shm);
+        return NULL;
+    }
+    shm->header = (shm_header_t*)addr;
+
+    const uint64_t ring_size = shm->header->ring_size;
+    if (shm->header->magic != RAID_SHM_MAGIC || shm->header->version != RAID_SHM_VERSION ||
+        ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+        shm->map_size != RAID_SHM_HEADER_SIZE + 2 * ring_size) {
+        shm_free(shm);
+        return NULL;
+    }
+
+    shm->ring_size = ring_size;
+    char* c2p_data = (char*)addr + RAID_SHM_HEADER_SIZE;
+    char* p2c_data = c2p_data + ring_size;
+    const int c2p_data_fd = shm->fds[SHM_FD_C2P_DATA - 1];
+    const int c2p_space_fd = shm->fds[SHM_FD_C2P_SPACE - 1];
+    const int p2c_data_fd = shm->fds[SHM_FD_P2C_DATA - 1];
+    const int p2c_space_fd = shm->fds[SHM_FD_P2C_SPACE - 1];
+    if (is_peer) {
+        shm->tx = &shm->header->rings[1];
+        shm->tx_data = p2c_data;
+        shm->tx_data_fd = p2c_data_fd;
+        shm->tx_space_fd = p2c_space_fd;
+        shm->rx = &shm->header->rings[0];
+        shm->rx_data = c2p_data;
+        shm->rx_data_fd = c2p_data_fd;
+        shm->rx_space_fd = c2p_space_fd;
+    }
+    else {
+        shm->tx = &shm->header->rings[0];
+        shm->tx_data = c2p_data;
+        shm->tx_data_fd = c2p_data_fd;
+        shm->tx_space_fd = c2p_space_fd;
+        shm->rx = &shm->header->rings[1];
+        shm->rx_data = p2c_data;
+        shm->rx_data_fd = p2c_data_fd;
+        shm->rx_space_fd = p2c_space_fd;
+    }
+    shm->tx_head = __atomic_load_n(&shm->tx->head, __ATOMIC_SEQ_CST);
+    shm->rx_tail = __atomic_load_n(&shm->rx->tail, __ATOMIC_SEQ_CST);
+    return shm;
+}
+
+static void shm_ring(int fd)
+{
+    const uint64_t one = 1;
+    ssize_t ret = write(fd, &one, sizeof(one));
+    (void)ret; // EAGAIN means it's rung already
+}
+
+// The stream can't go on, after a broken ring or half a frame. Wakes our receiver so it sees it.
+static raid_error_t shm_fail(struct raid_shm* shm, const char* reason)
+{
+    fprintf(stderr, "[raid] shared memory transport failed: %s\n", reason);
+    __atomic_store_n(&shm->closed, 1, __ATOMIC_SEQ_CST);
+    shm_ring(shm->rx_data_fd);
+    return RAID_NOT_CONNECTED;
+}
+
+// Wait for a doorbell, or for the peer to hang up the unix socket.
+// A negative timeout waits forever.
+static raid_error_t shm_wait(struct raid_shm* shm, int fd, int sock, int64_t timeout_ms)
+{
+    if (__atomic_load_n(&shm->closed, __ATOMIC_SEQ_CST)) {
+        return RAID_NOT_CONNECTED;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = sock;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (timeout_ms > INT_MAX) {
+        timeout_ms = INT_MAX;
+    }
+    int ret = poll(fds, 2, timeout_ms < 0 ? -1 : (int)timeout_ms);
+    if (ret == 0) {
+        return RAID_RECV_TIMEOUT;
+    }
+    if (ret < 0) {
+        return errno == EINTR ? RAID_SUCCESS : RAID_SOCKET_ERROR;
+    }
+    if (__atomic_load_n(&shm->closed, __ATOMIC_SEQ_CST)) {
+        return RAID_NOT_CONNECTED;
+    }
+    if (fds[1].revents) {
+        // Nothing else goes over the socket once set up, so it's the peer leaving.
+        return RAID_NOT_CONNECTED;
+    }
+
+    uint64_t value;
+    ssize_t n = read(fd, &value, sizeof(value));
+    (void)n;
+    return RAID_SUCCESS;
+}
+
+// Room left in the ring to write, or -1 if the peer moved the tail where it can't be.
+static int64_t shm_space(struct raid_shm* shm, int memorder)
+{
+    uint64_t used = shm->tx_head - __atomic_load_n(&shm->tx->tail, memorder);
+    return used > shm->ring_size ? -1 : (int64_t)(shm->ring_size - used);
+}
+
+// Waits for room up to timeout_ms (none if 0), the caller holds reqs_mutex so it can't block forever.
+static raid_error_t shm_write(struct raid_shm* shm, int sock, const char* data, size_t len, int64_t timeout_ms)
+{
+    const uint64_t size = shm->ring_size;
+    shm_ring_t* ring = shm->tx;
+    const int64_t deadline_ms = timeout_ms > 0 ? raid_clock_ms() + timeout_ms : RAID_NO_DEADLINE;
+
+    while (len > 0) {
+        const uint64_t head = shm->tx_head;
+        int64_t space = shm_space(shm, __ATOMIC_ACQUIRE);
+        if (space == 0) {
+            // Flag ourselves before checking again, so the consumer can't miss us.
+            __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+            space = shm_space(shm, __ATOMIC_SEQ_CST);
+            raid_error_t err = RAID_SUCCESS;
+            if (space == 0) {
+                int64_t left_ms = -1;
+                if (deadline_ms != RAID_NO_DEADLINE) {
+                    left_ms = deadline_ms - raid_clock_ms();
+                    if (left_ms <= 0) {
+                        err = RAID_RECV_TIMEOUT;
+                    }
+                }
+                if (err == RAID_SUCCESS) {
+                    err = shm_wait(shm, shm->tx_space_fd, sock, left_ms);
+                }
+            }
+            __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+            if (err == RAID_RECV_TIMEOUT) {
+                // Part of the frame might be in the ring already, there's no taking it back.
+                return shm_fail(shm, "timed out waiting for the peer to make room");
+            }
+            if (err != RAID_SUCCESS) {
+                return err;
+            }
+            continue;
+        }
+        if (space < 0) {
+            return shm_fail(shm, "the peer corrupted the ring");
+        }
+
+        size_t n = len < (uint64_t)space ? len : (size_t)space;
+        size_t offset = (size_t)(head & (size - 1));
+        size_t first = n < size - offset ? n : (size_t)(size - offset);
+        memcpy(shm->tx_data + offset, data, first);
+        memcpy(shm->tx_data, data + first, n - first);
+        shm->tx_head = head + n;
+        __atomic_store_n(&ring->head, head + n, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_SEQ_CST)) {
+            shm_ring(shm->tx_data_fd);
+        }
+
+        data += n;
+        len -= n;
+    }
+    return RAID_SUCCESS;
+}
+
+static raid_error_t shm_read(struct raid_shm* shm, int sock, char* buf, size_t buf_len, int64_t timeout_ms, int* out_len)
+{
+    const uint64_t size = shm->ring_size;
+    shm_ring_t* ring = shm->rx;
+    const uint64_t tail = shm->rx_tail;
+    if (__atomic_load_n(&shm->closed, __ATOMIC_SEQ_CST)) {
+        return RAID_NOT_CONNECTED;
+    }
+
+    uint64_t available = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    if (available == 0) {
+        __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        available = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) - tail;
+        raid_error_t err = RAID_SUCCESS;
+        if (available == 0) {
+            err = shm_wait(shm, shm->rx_data_fd, sock, timeout_ms > 0 ? timeout_ms : -1);
+            available = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) - tail;
+        }
+        __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_RELAXED);
+        if (err == RAID_NOT_CONNECTED || err == RAID_SOCKET_ERROR) {
+            return err;
+        }
+        if (available == 0) {
+            return RAID_RECV_TIMEOUT;
+        }
+    }
+    if (available > size) {
+        return shm_fail(shm, "the peer corrupted the ring");
+    }
+
+    size_t n = buf_len < available ? buf_len : (size_t)available;
+    size_t offset = (size_t)(tail & (size - 1));
+    size_t first = n < size - offset ? n : (size_t)(size - offset);
+    memcpy(buf, shm->rx_data + offset, first);
+    memcpy(buf + first, shm->rx_data, n - first);
+    shm->rx_tail = tail + n;
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST)) {
+        shm_ring(shm->rx_space_fd);
+    }
+
+    *out_len = (int)n;
+    return RAID_SUCCESS;
+}
+
+static int unix_socket_address(const char* path, struct sockaddr_un* addr, socklen_t* addr_len)
+{
+    size_t path_len = strlen(path);
+    if (path_len == 0 || path_len >= sizeof(addr->sun_path)) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, path_len);
+    *addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len + 1);
+    return 0;
+}
+
+raid_error_t raid_shm_connect(raid_socket_t* s, const char* path)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    if (unix_socket_address(path, &addr, &addr_len) == -1) {
+        fprintf(stderr, "invalid unix socket path: %s\n", path);
+        return RAID_INVALID_ADDRESS;
+    }
+
+    int fds[SHM_NUM_FDS];
+    for (int i = 0; i < SHM_NUM_FDS; i++) {
+        fds[i] = -1;
+    }
+
+    // Lay out the rings in an anonymous file only we and the peer can map.
+    const size_t map_size = RAID_SHM_HEADER_SIZE + 2 * (size_t)RAID_SHM_RING_SIZE;
+    fds[SHM_FD_MEMORY] = (int)syscall(SYS_memfd_create, "raid", MFD_CLOEXEC);
+    if (fds[SHM_FD_MEMORY] == -1 || ftruncate(fds[SHM_FD_MEMORY], (off_t)map_size) == -1) {
+        close_fds(fds, SHM_NUM_FDS);
+        return RAID_SOCKET_ERROR;
+    }
+    shm_header_t header = { 0 };
+    header.magic = RAID_SHM_MAGIC;
+    header.version = RAID_SHM_VERSION;
+    header.ring_size = RAID_SHM_RING_SIZE;
+    if (pwrite(fds[SHM_FD_MEMORY], &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        close_fds(fds, SHM_NUM_FDS);
+        return RAID_SOCKET_ERROR;
+    }
+    for (int i = SHM_FD_MEMORY + 1; i < SHM_NUM_FDS; i++) {
+        fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fds[i] == -1) {
+            close_fds(fds, SHM_NUM_FDS);
+            return RAID_SOCKET_ERROR;
+        }
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (const struct sockaddr*)&addr, addr_len) == -1) {
+        fprintf(stderr, "error connecting to: %s\n", path);
+        if (sock != -1) close(sock);
+        close_fds(fds, SHM_NUM_FDS);
+        return RAID_CONNECT_ERROR;
+    }
+
+    // Hand the memory and the doorbells over to the peer.
+    char hello = RAID_SHM_HELLO;
+    struct iovec iov = { &hello, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    raid_error_t err = RAID_SUCCESS;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+        err = RAID_CONNECT_ERROR;
+    }
+    else {
+        // The peer answers once it mapped the rings.
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int64_t timeout_ms = s->opts.connect_timeout_ms;
+        if (poll(&pfd, 1, timeout_ms > 0 ? (int)timeout_ms : -1) != 1 ||
+            recv(sock, &hello, 1, 0) != 1 || hello != RAID_SHM_HELLO) {
+            err = RAID_CONNECT_ERROR;
+        }
+    }
+
+    struct raid_shm* shm = NULL;
+    if (err == RAID_SUCCESS) {
+        shm = shm_new(fds[SHM_FD_MEMORY], fds + 1, false);
+        err = shm ? RAID_SUCCESS : RAID_SOCKET_ERROR;
+    }
+    else {
+        close_fds(fds + 1, SHM_NUM_FDS - 1);
+    }
+    close(fds[SHM_FD_MEMORY]);
+    if (err != RAID_SUCCESS) {
+        fprintf(stderr, "error setting up shared memory with: %s\n", path);
+        close(sock);
+        return err;
+    }
+
+    s->handle = sock;
+    s->family = AF_UNIX;
+    s->zerocopy = false;
+    __atomic_store_n(&s->shm, shm, __ATOMIC_SEQ_CST);
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_shm_listen(const char* path, int* out_handle)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    if (unix_socket_address(path, &addr, &addr_len) == -1) {
+        return RAID_INVALID_ADDRESS;
+    }
+
+    unlink(path);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return RAID_SOCKET_ERROR;
+    }
+    if (bind(sock, (const struct sockaddr*)&addr, addr_len) == -1 || listen(sock, 16) == -1) {
+        close(sock);
+        return RAID_SOCKET_ERROR;
+    }
+    *out_handle = sock;
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_shm_accept(int listen_handle, raid_socket_t* s)
+{
+    int sock = accept(listen_handle, NULL, NULL);
+    if (sock == -1) {
+        return RAID_SOCKET_ERROR;
+    }
+
+    int fds[SHM_NUM_FDS];
+    char hello = 0;
+    struct iovec iov = { &hello, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = NULL;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1 || hello != RAID_SHM_HELLO ||
+        !(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        if (cmsg && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(0)) {
+            // The buffer's padding can fit more fds than we asked for, the rest got truncated.
+            size_t len = cmsg->cmsg_len - CMSG_LEN(0);
+            if (len > sizeof(fds)) {
+                len = sizeof(fds);
+            }
+            memcpy(fds, CMSG_DATA(cmsg), len);
+            close_fds(fds, len / sizeof(int));
+        }
+        close(sock);
+        return RAID_SOCKET_ERROR;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    struct raid_shm* shm = shm_new(fds[SHM_FD_MEMORY], fds + 1, true);
+    close(fds[SHM_FD_MEMORY]);
+    if (!shm) {
+        close(sock);
+        return RAID_SOCKET_ERROR;
+    }
+    if (send(sock, &hello, 1, MSG_NOSIGNAL) != 1) {
+        shm_free(shm);
+        close(sock);
+        return RAID_SOCKET_ERROR;
+    }
+
+    s->handle = sock;
+    s->family = AF_UNIX;
+    s->zerocopy = false;
+    __atomic_store_n(&s->shm, shm, __ATOMIC_SEQ_CST);
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_shm_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs)
+{
+    // Senders are serialized by the caller, like for sockets.
+    struct raid_shm* shm = __atomic_load_n(&s->shm, __ATOMIC_SEQ_CST);
+    if (!shm) {
+        return RAID_NOT_CONNECTED;
+    }
+    if (__atomic_load_n(&shm->closed, __ATOMIC_SEQ_CST)) {
+        return RAID_NOT_CONNECTED;
+    }
+    // There's no separate send timeout, a peer that doesn't read for this long is gone.
+    for (size_t i = 0; i < num_bufs; i++) {
+        raid_error_t err = shm_write(shm, s->handle, bufs[i].data, bufs[i].len, s->opts.recv_timeout_ms);
+        if (err != RAID_SUCCESS) {
+            return err;
+        }
+    }
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_shm_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len)
+{
+    *out_len = 0;
+
+    // Announce ourselves before looking at the rings, raid_shm_close waits for us to leave.
+    __atomic_add_fetch(&s->shm_readers, 1, __ATOMIC_SEQ_CST);
+    struct raid_shm* shm = __atomic_load_n(&s->shm, __ATOMIC_SEQ_CST);
+    raid_error_t err = RAID_NOT_CONNECTED;
+    if (shm) {
+        err = shm_read(shm, s->handle, buf, buf_len, s->opts.recv_timeout_ms, out_len);
+    }
+    __atomic_sub_fetch(&s->shm_readers, 1, __ATOMIC_SEQ_CST);
+    return err;
+}
+
+raid_error_t raid_shm_close(raid_socket_t* s)
+{
+    struct raid_shm* shm = __atomic_exchange_n(&s->shm, NULL, __ATOMIC_SEQ_CST);
+    if (!shm) {
+        return RAID_NOT_CONNECTED;
+    }
+
+    // Wake up a receiver blocked on the rings and wait for it to leave.
+    __atomic_store_n(&shm->closed, 1, __ATOMIC_SEQ_CST);
+    shm_ring(shm->rx_data_fd);
+    shm_ring(shm->tx_space_fd);
+    while (__atomic_load_n(&s->shm_readers, __ATOMIC_SEQ_CST) > 0) {
+        poll(NULL, 0, 1);
+    }
+
+    raid_error_t err = RAID_SUCCESS;
+    shutdown(s->handle, SHUT_RDWR);
+    if (close(s->handle) == -1) {
+        err = RAID_CLOSE_ERROR;
+    }
+    s->handle = -1;
+    shm_free(shm);
+    return err;
+}
+
+#else
+
+raid_error_t raid_shm_connect(raid_socket_t* s, const char* path)
+{
+    (void)s;
+    fprintf(stderr, "shared memory transport is not supported: %s\n", path);
+    return RAID_INVALID_ADDRESS;
+}
+
+raid_error_t raid_shm_listen(const char* path, int* out_handle)
+{
+    (void)path;
+    (void)out_handle;
+    return RAID_INVALID_ADDRESS;
+}
+
+raid_error_t raid_shm_accept(int listen_handle, raid_socket_t* s)
+{
+    (void)listen_handle;
+    (void)s;
+    return RAID_INVALID_ADDRESS;
+}
+
+raid_error_t raid_shm_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs)
+{
+    (void)s;
+    (void)bufs;
+    (void)num_bufs;
+    return RAID_NOT_CONNECTED;
+}
+
+raid_error_t raid_shm_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len)
+{
+    (void)s;
+    (void)buf;
+    (void)buf_len;
+    *out_len = 0;
+    return RAID_NOT_CONNECTED;
+}
+
+raid_error_t raid_shm_close(raid_socket_t* s)
+{
+    (void)s;
+    return RAID_NOT_CONNECTED;
+}
+
+#endif
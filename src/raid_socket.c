@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include "raid.h"
 #include "raid_internal.h"
 
@@ -10,12 +13,116 @@
 #include <netinet/in.h>
 #include <stdio.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #endif
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <poll.h>
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#endif
+
+// Maximum number of buffers passed to each sendmsg call, Linux's UIO_MAXIOV.
+#define RAID_SENDV_MAX_IOV 1024
+
+// Connection attempts raced per connect, and the delay before starting the next one.
+#define RAID_CONNECT_MAX_CANDIDATES 16
+#define RAID_CONNECT_ATTEMPT_DELAY_MS 250
+
+// Options that only take effect if set before connecting, like the buffer
+// sizes the TCP window scale is negotiated from.
+static void socket_set_connect_options(int fd, const raid_socket_options_t* opts)
+{
+    if (opts->send_buffer_size > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&opts->send_buffer_size, sizeof(int));
+    }
+    if (opts->recv_buffer_size > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&opts->recv_buffer_size, sizeof(int));
+    }
+}
+
+// TCP_QUICKACK doesn't stick, the kernel can go back to delayed ACKs at any time.
+static void socket_set_quickack(int fd, const raid_socket_options_t* opts)
+{
+#ifdef TCP_QUICKACK
+    if (opts->quickack) {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, (const char*)&one, sizeof(one));
+    }
+#else
+    (void)fd;
+    (void)opts;
+#endif
+}
+
+static void socket_set_options(int fd, int family, const raid_socket_options_t* opts)
+{
+    const int one = 1;
+    const bool tcp = family != AF_UNIX;
+    if (tcp && opts->nodelay) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+    }
+    if (tcp && opts->keepalive) {
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&one, sizeof(one));
+#ifdef TCP_KEEPIDLE
+        if (opts->keepalive_idle_secs > 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&opts->keepalive_idle_secs, sizeof(int));
+        }
+#endif
+#ifdef TCP_KEEPINTVL
+        if (opts->keepalive_interval_secs > 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&opts->keepalive_interval_secs, sizeof(int));
+        }
+#endif
+#ifdef TCP_KEEPCNT
+        if (opts->keepalive_count > 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&opts->keepalive_count, sizeof(int));
+        }
+#endif
+    }
+#ifdef SO_BUSY_POLL
+    if (opts->busy_poll_usecs > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (const char*)&opts->busy_poll_usecs, sizeof(int));
+    }
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (tcp && opts->user_timeout_ms > 0) {
+        const unsigned int user_timeout = (unsigned int)opts->user_timeout_ms;
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, (const char*)&user_timeout, sizeof(user_timeout));
+    }
+#endif
+    if (tcp) {
+        socket_set_quickack(fd, opts);
+    }
+
+    // Set the socket recv timeout
+#ifdef _WIN32
+    const DWORD timeout = (DWORD)opts->recv_timeout_ms;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+#else
+    struct timeval tv = { 0 };
+    tv.tv_sec = opts->recv_timeout_ms / 1000;
+    tv.tv_usec = (opts->recv_timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+#endif
+}
+
 #ifdef _WIN32
 #pragma comment(lib, "Ws2_32.lib")
 
@@ -95,53 +202,81 @@ static void destroy_context()
     WSACleanup();
 }
 
-static raid_error_t socket_impl_connect(raid_socket_t* s, const char* host, const char* port)
+static void socket_impl_init()
 {
     static bool inited;
     if (!inited) {
         init_context();
         inited = true;
     }
+}
 
-    int ret = 0;
+static raid_error_t socket_impl_resolve_unix(const char* path, raid_address_t** out_addrs, size_t* out_num_addrs)
+{
+    (void)out_addrs;
+    (void)out_num_addrs;
+    fprintf(stderr, "unix domain sockets are not supported: %s\n", path);
+    return RAID_INVALID_ADDRESS;
+}
 
-    // Translate the human-readable address to a network binary address.
-    struct addrinfo* addr_info = NULL;
-    struct addrinfo hints = { 0 };
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+static raid_error_t socket_impl_connect(raid_socket_t* s, const raid_address_t* addrs, size_t num_addrs, const char* name)
+{
+    socket_impl_init();
 
-    ret = getaddrinfo(host, port, &hints, &addr_info);
-    if (ret != 0) {
-        fprintf(stderr, "getaddrinfo failed with error: %d\n", ret);
-        return RAID_INVALID_ADDRESS;
-    }
+    int ret = 0;
 
-    // Create the socket.
-    s->handle = socket(AF_INET, SOCK_STREAM, 0);
-    if ((int)s->handle == -1) {
-        fprintf(stderr, "error creating socket\n");
-        return RAID_SOCKET_ERROR;
+    // Try each address in turn, each with what's left of the timeout.
+    const int64_t deadline = s->opts.connect_timeout_ms > 0 ? raid_clock_ms() + s->opts.connect_timeout_ms : -1;
+    s->handle = -1;
+    for (size_t i = 0; i < num_addrs && s->handle == -1; i++) {
+        struct sockaddr_storage addr;
+        memcpy(&addr, addrs[i].data, addrs[i].len);
+
+        SOCKET fd = socket(addrs[i].family, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET) {
+            continue;
+        }
+
+        socket_set_connect_options((int)fd, &s->opts);
+        u_long non_blocking = 1;
+        ioctlsocket(fd, FIONBIO, &non_blocking);
+        ret = connect(fd, (const struct sockaddr*)&addr, (int)addrs[i].len);
+        if (ret == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+            int64_t left_ms = deadline >= 0 ? deadline - raid_clock_ms() : -1;
+            if (deadline >= 0 && left_ms <= 0) {
+                closesocket(fd);
+                break;
+            }
+
+            fd_set write_fds, err_fds;
+            FD_ZERO(&write_fds);
+            FD_ZERO(&err_fds);
+            FD_SET(fd, &write_fds);
+            FD_SET(fd, &err_fds);
+            struct timeval tv = { 0 };
+            tv.tv_sec = (long)(left_ms / 1000);
+            tv.tv_usec = (long)(left_ms % 1000) * 1000;
+            ret = select(0, NULL, &write_fds, &err_fds, left_ms >= 0 ? &tv : NULL);
+            ret = (ret > 0 && FD_ISSET(fd, &write_fds)) ? 0 : SOCKET_ERROR;
+        }
+        if (ret == SOCKET_ERROR) {
+            closesocket(fd);
+            continue;
+        }
+
+        non_blocking = 0;
+        ioctlsocket(fd, FIONBIO, &non_blocking);
+        s->handle = (int)fd;
+        s->family = addrs[i].family;
     }
 
-    // Connect to the first address we found.
-    struct sockaddr* server_addr = addr_info->ai_addr;
-    ret = connect((int)s->handle, server_addr, sizeof(struct sockaddr));
-    if (ret == -1) {
-        fprintf(stderr, "error connecting to: %s\n", host);
-        freeaddrinfo(addr_info);
+    if (s->handle == -1) {
+        fprintf(stderr, "error connecting to: %s\n", name);
         return RAID_CONNECT_ERROR;
     }
 
-    // Set the socket recv timeout
-    const int kSocketTimeoutSeconds = 10*1000;
-    struct timeval tv = { 0 };
-    tv.tv_sec = kSocketTimeoutSeconds;
-    tv.tv_usec = 0;
-    setsockopt((int)s->handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    socket_set_options(s->handle, s->family, &s->opts);
 
-    freeaddrinfo(addr_info);
     return RAID_SUCCESS;
 }
 
@@ -170,10 +305,27 @@ static raid_error_t socket_impl_send(raid_socket_t* s, const char* data, size_t
     return res;
 }
 
+static raid_error_t socket_impl_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs)
+{
+    for (size_t i = 0; i < num_bufs; i++) {
+        if (bufs[i].len == 0) continue;
+
+        raid_error_t res = socket_impl_send(s, bufs[i].data, bufs[i].len);
+        if (res != RAID_SUCCESS) {
+            return res;
+        }
+    }
+    return RAID_SUCCESS;
+}
+
 static raid_error_t socket_impl_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len)
 {
     *out_len = recv(s->handle, buf, buf_len, 0);
     int err = WSAGetLastError();
+    if (*out_len == 0 && buf_len > 0) {
+        // The peer closed the connection.
+        return RAID_NOT_CONNECTED;
+    }
 
     if (errno == EWOULDBLOCK || errno == EAGAIN || err == WSAETIMEDOUT) {
         return RAID_RECV_TIMEOUT;
@@ -275,47 +427,187 @@ static bool is_not_connected_err(int val)
     );
 }
 
-static raid_error_t socket_impl_connect(raid_socket_t* s, const char* host, const char* port)
+static void socket_impl_init()
 {
-    int ret = 0;
-
-    // Translate the human-readable address to a network binary address.
-    struct addrinfo* addr_info = NULL;
-    struct addrinfo hints = { 0 };
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+}
 
-    ret = getaddrinfo(host, port, &hints, &addr_info);
-    if (ret != 0) {
-        fprintf(stderr, "getaddrinfo failed with error: %d\n", ret);
+static raid_error_t socket_impl_resolve_unix(const char* path, raid_address_t** out_addrs, size_t* out_num_addrs)
+{
+    struct sockaddr_un addr = { 0 };
+    size_t path_len = strlen(path);
+    if (path_len == 0 || path_len >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "invalid unix socket path: %s\n", path);
         return RAID_INVALID_ADDRESS;
     }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, path_len);
 
-    // Create the socket.
-    s->handle = socket(AF_INET, SOCK_STREAM, 0);
-    if ((int)s->handle == -1) {
-        fprintf(stderr, "error creating socket\n");
-        return RAID_SOCKET_ERROR;
+    raid_address_t* a = malloc(sizeof(raid_address_t));
+    if (!a) {
+        return RAID_UNKNOWN;
     }
+    a->family = AF_UNIX;
+    a->len = offsetof(struct sockaddr_un, sun_path) + path_len + 1;
+    memcpy(a->data, &addr, a->len);
+    *out_addrs = a;
+    *out_num_addrs = 1;
+    return RAID_SUCCESS;
+}
 
-    // Connect to the first address we found.
-    struct sockaddr* server_addr = addr_info->ai_addr;
-    ret = connect((int)s->handle, server_addr, sizeof(struct sockaddr));
-    if (ret == -1) {
-        fprintf(stderr, "error connecting to: %s\n", host);
-        freeaddrinfo(addr_info);
+// Order the addresses alternating between families, starting with the
+// family the resolver prefers, so a broken family can't stall the connect.
+static size_t interleave_addresses(const raid_address_t* addrs, size_t num_addrs, const raid_address_t** out, size_t max_out)
+{
+    size_t first = 0;
+    size_t other = 0;
+    while (other < num_addrs && addrs[other].family == addrs[first].family) other++;
+
+    size_t n = 0;
+    while ((first < num_addrs || other < num_addrs) && n < max_out) {
+        if (first < num_addrs) {
+            out[n++] = &addrs[first];
+            do { first++; } while (first < num_addrs && addrs[first].family != addrs[0].family);
+        }
+        if (other < num_addrs && n < max_out) {
+            out[n++] = &addrs[other];
+            do { other++; } while (other < num_addrs && addrs[other].family == addrs[0].family);
+        }
+    }
+    return n;
+}
+
+// Start a non-blocking connect, returns the socket or -1 if it failed right away.
+static int start_connect(const raid_address_t* a, const raid_socket_options_t* opts, bool* connected)
+{
+    struct sockaddr_storage addr;
+    memcpy(&addr, a->data, a->len);
+
+    int fd = socket(a->family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    socket_set_connect_options(fd, opts);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int ret = connect(fd, (const struct sockaddr*)&addr, (socklen_t)a->len);
+    *connected = (ret == 0);
+    if (ret == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static raid_error_t socket_impl_connect(raid_socket_t* s, const raid_address_t* addrs, size_t num_addrs, const char* name)
+{
+    int ret = 0;
+
+    const raid_address_t* candidates[RAID_CONNECT_MAX_CANDIDATES];
+    size_t num_candidates = interleave_addresses(addrs, num_addrs, candidates, RAID_CONNECT_MAX_CANDIDATES);
+
+    // Race the candidates, starting the next one whenever the previous fails or
+    // takes longer than the attempt delay (RFC 8305).
+    struct pollfd fds[RAID_CONNECT_MAX_CANDIDATES];
+    int families[RAID_CONNECT_MAX_CANDIDATES];
+    size_t num_fds = 0;
+    size_t next = 0;
+    int winner = -1;
+    int winner_family = AF_UNSPEC;
+    const int64_t start = raid_clock_ms();
+    const int64_t deadline = s->opts.connect_timeout_ms > 0 ? start + s->opts.connect_timeout_ms : -1;
+    int64_t next_start = start;
+
+    while (winner == -1) {
+        int64_t now = raid_clock_ms();
+        if (deadline >= 0 && now >= deadline) {
+            break;
+        }
+
+        if (next < num_candidates && (now >= next_start || num_fds == 0)) {
+            bool connected = false;
+            const raid_address_t* candidate = candidates[next++];
+            int fd = start_connect(candidate, &s->opts, &connected);
+            if (fd != -1 && connected) {
+                winner = fd;
+                winner_family = candidate->family;
+                break;
+            }
+            if (fd != -1) {
+                fds[num_fds].fd = fd;
+                fds[num_fds].events = POLLOUT;
+                fds[num_fds].revents = 0;
+                families[num_fds] = candidate->family;
+                num_fds++;
+                next_start = now + RAID_CONNECT_ATTEMPT_DELAY_MS;
+            }
+            continue;
+        }
+        if (num_fds == 0) {
+            break;
+        }
+
+        int64_t wait_ms = -1;
+        if (next < num_candidates) {
+            wait_ms = next_start - now;
+        }
+        if (deadline >= 0 && (wait_ms < 0 || deadline - now < wait_ms)) {
+            wait_ms = deadline - now;
+        }
+
+        ret = poll(fds, num_fds, (int)wait_ms);
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (size_t i = 0; i < num_fds && winner == -1; i++) {
+            if (!fds[i].revents) continue;
+
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err == 0) {
+                winner = fds[i].fd;
+                winner_family = families[i];
+            }
+            else {
+                // This one failed, the next candidate can start right away.
+                close(fds[i].fd);
+                num_fds--;
+                families[i] = families[num_fds];
+                fds[i--] = fds[num_fds];
+                next_start = now;
+            }
+        }
+    }
+
+    // Close the attempts that lost the race.
+    for (size_t i = 0; i < num_fds; i++) {
+        if (fds[i].fd != winner) {
+            close(fds[i].fd);
+        }
+    }
+
+    if (winner == -1) {
+        fprintf(stderr, "error connecting to: %s\n", name);
+        s->handle = -1;
         return RAID_CONNECT_ERROR;
     }
 
-    // Set the socket recv timeout
-    const int kSocketTimeoutSeconds = 10;
-    struct timeval tv = { 0 };
-    tv.tv_sec = kSocketTimeoutSeconds;
-    tv.tv_usec = 0;
-    setsockopt((int)s->handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    // The rest of the client expects a blocking socket.
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL, 0) & ~O_NONBLOCK);
+    s->handle = winner;
+    s->family = winner_family;
+    socket_set_options(s->handle, s->family, &s->opts);
+
+    // Allow MSG_ZEROCOPY sends, it's fine if the kernel doesn't support it.
+    s->zerocopy = false;
+    s->zerocopy_sent = 0;
+    s->zerocopy_done = 0;
+#ifdef __linux__
+    const int one = 1;
+    s->zerocopy = setsockopt((int)s->handle, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
 
-    freeaddrinfo(addr_info);
     return RAID_SUCCESS;
 }
 
@@ -344,14 +636,160 @@ static raid_error_t socket_impl_send(raid_socket_t* s, const char* data, size_t
     return res;
 }
 
+#ifdef __linux__
+// Read the zero-copy completions already in the error queue, without waiting for the rest.
+static void socket_reap_zerocopy(raid_socket_t* s)
+{
+    while ((int32_t)(s->zerocopy_sent - s->zerocopy_done) > 0) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = { 0 };
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        const ssize_t ret = recvmsg((int)s->handle, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            // Nothing more yet, or the socket is gone and so are the pages it pinned.
+            return;
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const struct sock_extended_err* serr = (const struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Completions come in ranges of send ids, [ee_info, ee_data].
+            s->zerocopy_done += serr->ee_data - serr->ee_info + 1;
+        }
+    }
+}
+#endif
+
+// Send every buffer, in as few sendmsg calls as the iovec limit allows.
+static raid_error_t socket_sendmsg_all(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs, int flags)
+{
+    size_t i = 0;
+    size_t sent = 0; // bytes of bufs[i] already sent
+    while (i < num_bufs) {
+        struct iovec iov[RAID_SENDV_MAX_IOV];
+        struct msghdr msg = { 0 };
+        size_t total = 0;
+        for (size_t k = i; k < num_bufs && msg.msg_iovlen < RAID_SENDV_MAX_IOV; k++) {
+            size_t skip = (k == i) ? sent : 0;
+            iov[msg.msg_iovlen].iov_base = (void*)(bufs[k].data + skip);
+            iov[msg.msg_iovlen].iov_len = bufs[k].len - skip;
+            total += bufs[k].len - skip;
+            msg.msg_iovlen++;
+        }
+        msg.msg_iov = iov;
+
+        const ssize_t nwrite = sendmsg((int)s->handle, &msg, flags);
+        if (nwrite < 0 && errno == EINTR) {
+            continue;
+        }
+#ifdef __linux__
+        if (nwrite < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+            // Out of pinned page budget, copy the rest.
+            flags &= ~MSG_ZEROCOPY;
+            continue;
+        }
+        if (nwrite >= 0 && (flags & MSG_ZEROCOPY)) {
+            s->zerocopy_sent++;
+        }
+#endif
+        if (nwrite < 0 || (nwrite == 0 && total > 0)) {
+            socket_log_error("sendmsg");
+            return is_not_connected_err(errno) ? RAID_NOT_CONNECTED : RAID_UNKNOWN;
+        }
+
+        // Skip what was sent, the kernel might have taken only part of it.
+        size_t left = (size_t)nwrite;
+        while (i < num_bufs && left >= bufs[i].len - sent) {
+            left -= bufs[i].len - sent;
+            sent = 0;
+            i++;
+        }
+        sent += left;
+    }
+    return RAID_SUCCESS;
+}
+
+// Only binary references outlive the send, the length prefixes and the
+// writer's own buffer can be reused as soon as it returns.
+static bool is_zerocopy_buf(const raid_socket_t* s, const raid_buf_t* buf)
+{
+#ifdef __linux__
+    return buf->zerocopy && s->zerocopy && s->opts.zerocopy_threshold > 0 &&
+        buf->len >= s->opts.zerocopy_threshold;
+#else
+    (void)s;
+    (void)buf;
+    return false;
+#endif
+}
+
+static raid_error_t socket_impl_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs)
+{
+    if (!raid_socket_connected(s)) {
+        return RAID_NOT_CONNECTED;
+    }
+
+#ifdef __linux__
+    socket_reap_zerocopy(s);
+#endif
+
+    // Runs of copied and zero-copy buffers go in separate calls, corked so
+    // they still leave in full segments.
+    raid_error_t err = RAID_SUCCESS;
+    size_t i = 0;
+    while (i < num_bufs && err == RAID_SUCCESS) {
+        const bool zerocopy = is_zerocopy_buf(s, &bufs[i]);
+        size_t n = 1;
+        while (i + n < num_bufs && is_zerocopy_buf(s, &bufs[i + n]) == zerocopy) {
+            n++;
+        }
+
+        int flags = MSG_NOSIGNAL;
+#ifdef __linux__
+        if (zerocopy) {
+            flags |= MSG_ZEROCOPY;
+        }
+#endif
+#ifdef MSG_MORE
+        if (i + n < num_bufs) {
+            flags |= MSG_MORE;
+        }
+#endif
+        err = socket_sendmsg_all(s, bufs + i, n, flags);
+        i += n;
+    }
+
+#ifdef __linux__
+    // Completions still pending are picked up by later sends or the receive thread.
+    socket_reap_zerocopy(s);
+#endif
+    return err;
+}
+
 static raid_error_t socket_impl_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len)
 {
     if (!raid_socket_connected(s)) {
         return RAID_NOT_CONNECTED;
     }
 
+    errno = 0;
     *out_len = recv((int)s->handle, buf, buf_len, 0);
     //printf("%d\n", *out_len);
+    if (*out_len == 0 && buf_len > 0) {
+        // The peer closed the connection.
+        return RAID_NOT_CONNECTED;
+    }
     if (errno == EWOULDBLOCK || errno == EAGAIN) {
         return RAID_RECV_TIMEOUT;
     }
@@ -363,6 +801,9 @@ static raid_error_t socket_impl_recv(raid_socket_t* s, char* buf, size_t buf_len
         socket_log_error("recv");
         return RAID_UNKNOWN;
     }
+    if (s->family != AF_UNIX) {
+        socket_set_quickack(s->handle, &s->opts);
+    }
     return RAID_SUCCESS;
 }
 
@@ -386,9 +827,63 @@ static raid_error_t socket_impl_disconnect(raid_socket_t* s)
 
 #endif
 
-raid_error_t raid_socket_connect(raid_socket_t* s, const char* host, const char* port)
+raid_error_t raid_socket_resolve(const char* host, const char* port, raid_address_t** out_addrs, size_t* out_num_addrs)
+{
+    if (raid_is_unix_address(host)) {
+        return socket_impl_resolve_unix(host + strlen(RAID_UNIX_ADDRESS_PREFIX), out_addrs, out_num_addrs);
+    }
+
+    socket_impl_init();
+
+    // Translate the human-readable address to a network binary address.
+    struct addrinfo* addr_info = NULL;
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    int ret = getaddrinfo(host, port, &hints, &addr_info);
+    if (ret != 0) {
+        fprintf(stderr, "getaddrinfo failed with error: %d\n", ret);
+        return RAID_INVALID_ADDRESS;
+    }
+
+    size_t num_addrs = 0;
+    for (struct addrinfo* ai = addr_info; ai; ai = ai->ai_next) {
+        num_addrs++;
+    }
+
+    raid_address_t* addrs = malloc(num_addrs * sizeof(raid_address_t));
+    if (!addrs) {
+        freeaddrinfo(addr_info);
+        return RAID_UNKNOWN;
+    }
+
+    size_t n = 0;
+    for (struct addrinfo* ai = addr_info; ai; ai = ai->ai_next) {
+        if (ai->ai_addrlen > RAID_ADDRESS_MAX_LEN) continue;
+        addrs[n].family = ai->ai_family;
+        addrs[n].len = ai->ai_addrlen;
+        memcpy(addrs[n].data, ai->ai_addr, ai->ai_addrlen);
+        n++;
+    }
+    freeaddrinfo(addr_info);
+
+    if (n == 0) {
+        free(addrs);
+        return RAID_INVALID_ADDRESS;
+    }
+    *out_addrs = addrs;
+    *out_num_addrs = n;
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_socket_connect(raid_socket_t* s, const raid_address_t* addrs, size_t num_addrs, const char* name)
 {
-    return socket_impl_connect(s, host, port);
+    if (num_addrs == 0) {
+        return RAID_INVALID_ADDRESS;
+    }
+    return socket_impl_connect(s, addrs, num_addrs, name);
 }
 
 bool raid_socket_connected(raid_socket_t* s)
@@ -398,16 +893,49 @@ bool raid_socket_connected(raid_socket_t* s)
 
 raid_error_t raid_socket_send(raid_socket_t* s, const char* data, size_t data_len)
 {
+    if (s->shm) {
+        raid_buf_t buf = { data, data_len, false };
+        return raid_shm_sendv(s, &buf, 1);
+    }
     return socket_impl_send(s, data, data_len);
 }
 
+raid_error_t raid_socket_sendv(raid_socket_t* s, const raid_buf_t* bufs, size_t num_bufs)
+{
+    if (s->shm) {
+        return raid_shm_sendv(s, bufs, num_bufs);
+    }
+    return socket_impl_sendv(s, bufs, num_bufs);
+}
+
+size_t raid_socket_zerocopy_pending(raid_socket_t* s)
+{
+#ifdef __linux__
+    if (s->shm || !raid_socket_connected(s)) {
+        return 0;
+    }
+    socket_reap_zerocopy(s);
+    int32_t pending = (int32_t)(s->zerocopy_sent - s->zerocopy_done);
+    return pending > 0 ? (size_t)pending : 0;
+#else
+    (void)s;
+    return 0;
+#endif
+}
+
 raid_error_t raid_socket_recv(raid_socket_t* s, char* buf, size_t buf_len, int* out_len)
 {
+    if (s->shm) {
+        return raid_shm_recv(s, buf, buf_len, out_len);
+    }
     return socket_impl_recv(s, buf, buf_len, out_len);
 }
 
 raid_error_t raid_socket_close(raid_socket_t* s)
 {
+    if (s->shm) {
+        return raid_shm_close(s);
+    }
     raid_error_t err = socket_impl_disconnect(s);
     return err;
 }
\ No newline at end of file
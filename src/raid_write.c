@@ -12,14 +12,144 @@
 
 #define RAID_ETAG_SIZE 8
 
+// Idle writers kept by each client.
+#define RAID_WRITER_POOL_SIZE 16
+
+// Writers with a bigger buffer than this are deleted instead of pooled.
+#define RAID_WRITER_POOL_MAX_DATA (4*1024*1024)
+
+// Smaller binary references are just copied, a separate segment isn't worth it.
+#define RAID_WRITER_REF_MIN_SIZE (4*1024)
+
 static void msgpack_pack_str_with_body(msgpack_packer* pk, const char* str, size_t len)
 {
     msgpack_pack_str(pk, len);
     msgpack_pack_str_body(pk, str, len);
 }
 
+static char* sbuffer_reserve(msgpack_sbuffer* sbuf, size_t len)
+{
+    if (sbuf->alloc - sbuf->size < len) {
+        size_t nsize = sbuf->alloc ? sbuf->alloc * 2 : MSGPACK_SBUFFER_INIT_SIZE;
+        while (nsize < sbuf->size + len) {
+            nsize *= 2;
+        }
+
+        char* data = realloc(sbuf->data, nsize);
+        if (data == NULL) return NULL;
+
+        sbuf->data = data;
+        sbuf->alloc = nsize;
+    }
+    return sbuf->data + sbuf->size;
+}
+
+static char* store_be16(char* p, uint16_t n)
+{
+    p[0] = (char)(n >> 8);
+    p[1] = (char)n;
+    return p + 2;
+}
+
+static char* store_be32(char* p, uint32_t n)
+{
+    p[0] = (char)(n >> 24);
+    p[1] = (char)(n >> 16);
+    p[2] = (char)(n >> 8);
+    p[3] = (char)n;
+    return p + 4;
+}
+
+static char* store_be64(char* p, uint64_t n)
+{
+    p = store_be32(p, (uint32_t)(n >> 32));
+    return store_be32(p, (uint32_t)n);
+}
+
+// Same encoding msgpack_pack_int64 picks.
+static char* pack_int64(char* p, int64_t d)
+{
+    if (d < -(1LL<<5)) {
+        if (d < -(1LL<<15)) {
+            if (d < -(1LL<<31)) {
+                *p++ = (char)0xd3;
+                return store_be64(p, (uint64_t)d);
+            }
+            *p++ = (char)0xd2;
+            return store_be32(p, (uint32_t)d);
+        }
+        if (d < -(1<<7)) {
+            *p++ = (char)0xd1;
+            return store_be16(p, (uint16_t)d);
+        }
+        *p++ = (char)0xd0;
+        *p++ = (char)d;
+        return p;
+    }
+    else if (d < (1<<7)) {
+        *p++ = (char)d;
+        return p;
+    }
+    else if (d < (1LL<<16)) {
+        if (d < (1<<8)) {
+            *p++ = (char)0xcc;
+            *p++ = (char)d;
+            return p;
+        }
+        *p++ = (char)0xcd;
+        return store_be16(p, (uint16_t)d);
+    }
+    else if (d < (1LL<<32)) {
+        *p++ = (char)0xce;
+        return store_be32(p, (uint32_t)d);
+    }
+    *p++ = (char)0xcf;
+    return store_be64(p, (uint64_t)d);
+}
+
+static void gen_etag(raid_client_t* cl, char* buf)
+{
+    static const char ucase[] = "qwertyuiopasdfghjklzxcvbnmMNBVCXZLKJHGFDSAPOIUYTREWQ1234567890";
+    srand(time(NULL)+(cl->etag_gen_cnt++)*3);
+
+    const size_t ucase_count = sizeof(ucase) - 1;
+    for (int i = 0; i < RAID_ETAG_SIZE; i++) {
+        char random_char;
+        int random_index = (double)rand() / RAND_MAX * ucase_count;
+        random_char = ucase[random_index];
+        buf[i] = random_char;
+    }
+    buf[RAID_ETAG_SIZE] = '\0';
+}
+
+static void writer_begin_message(raid_writer_t* w, const char* action, size_t action_len)
+{
+    // Etags always have the same size, so keep the buffer around.
+    if (!w->etag) {
+        w->etag = malloc(sizeof(char)*(RAID_ETAG_SIZE + 1));
+    }
+
+    pthread_mutex_lock(&w->cl->reqs_mutex);
+    gen_etag(w->cl, w->etag);
+    w->idempotent = raid_is_idempotent_action_locked(w->cl, action, action_len);
+    pthread_mutex_unlock(&w->cl->reqs_mutex);
+}
+
+static void writer_clear_refs(raid_writer_t* w)
+{
+    for (size_t i = 0; i < w->num_refs; i++) {
+        raid_writer_ref_t* ref = &w->refs[i];
+        if (ref->release) {
+            ref->release(ref->data, ref->len, ref->user_data);
+        }
+    }
+    w->num_refs = 0;
+    w->refs_len = 0;
+}
+
 static raid_error_t raid_write_message_ex(raid_writer_t* w, const char* action, bool write_body)
 {
+    writer_clear_refs(w);
     msgpack_sbuffer_clear(&w->sbuf);
 
     /* serialize values into the buffer using msgpack_sbuffer_write callback function. */
@@ -30,13 +160,7 @@ static raid_error_t raid_write_message_ex(raid_writer_t* w, const char* action,
     {
         msgpack_pack_map(pk, 2);
 
-        if (w->etag) {
-            free(w->etag);
-        }
-
-        pthread_mutex_lock(&w->cl->reqs_mutex);
-        w->etag = raid_gen_etag(w->cl);
-        pthread_mutex_unlock(&w->cl->reqs_mutex);
+        writer_begin_message(w, action, strlen(action));
 
         msgpack_pack_str_with_body(pk, RAID_KEY_ACTION, sizeof(RAID_KEY_ACTION) - 1);
         msgpack_pack_str_with_body(pk, action, strlen(action));
@@ -51,24 +175,89 @@ static raid_error_t raid_write_message_ex(raid_writer_t* w, const char* action,
     return RAID_SUCCESS;
 }
 
-char* raid_gen_etag(raid_client_t* cl)
+static raid_error_t raid_write_message_action_ex(raid_writer_t* w, const raid_action_t* action, bool write_body)
 {
-    static const char ucase[] = "qwertyuiopasdfghjklzxcvbnmMNBVCXZLKJHGFDSAPOIUYTREWQ1234567890";
-    srand(time(NULL)+(cl->etag_gen_cnt++)*3);
+    if (!action || !action->envelope) return RAID_INVALID_ARGUMENT;
 
-    char* buf = malloc(sizeof(char)*(RAID_ETAG_SIZE + 1));
-    const size_t ucase_count = sizeof(ucase) - 1;
-    for (int i = 0; i < RAID_ETAG_SIZE; i++) {
-        char random_char;
-        int random_index = (double)rand() / RAND_MAX * ucase_count;
-        random_char = ucase[random_index];
-        buf[i] = random_char;
+    writer_clear_refs(w);
+    msgpack_sbuffer_clear(&w->sbuf);
+
+    // The envelope ends with the body key, which is left out along with
+    // the map size being patched when there's no body.
+    size_t len = action->envelope_len;
+    if (!write_body) {
+        len -= sizeof(RAID_KEY_BODY);
+    }
+    msgpack_sbuffer_write(&w->sbuf, action->envelope, len);
+    if (!write_body) {
+        w->sbuf.data[0] = (char)0x81;
     }
-    buf[RAID_ETAG_SIZE] = '\0';
 
+    writer_begin_message(w, action->name, strlen(action->name));
+    memcpy(w->sbuf.data + action->etag_offset, w->etag, RAID_ETAG_SIZE);
+    return RAID_SUCCESS;
+}
+
+char* raid_gen_etag(raid_client_t* cl)
+{
+    char* buf = malloc(sizeof(char)*(RAID_ETAG_SIZE + 1));
+    gen_etag(cl, buf);
     return buf;
 }
 
+raid_error_t raid_action_init(raid_action_t* a, const char* name)
+{
+    memset(a, 0, sizeof(raid_action_t));
+    if (!name) return RAID_INVALID_ARGUMENT;
+
+    msgpack_sbuffer sbuf;
+    msgpack_packer pk;
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+    // Same layout written by raid_write_message_ex, with a blank etag.
+    msgpack_pack_map(&pk, 2);
+    msgpack_pack_str_with_body(&pk, RAID_KEY_HEADER, sizeof(RAID_KEY_HEADER) - 1);
+    msgpack_pack_map(&pk, 2);
+    msgpack_pack_str_with_body(&pk, RAID_KEY_ACTION, sizeof(RAID_KEY_ACTION) - 1);
+    msgpack_pack_str_with_body(&pk, name, strlen(name));
+    msgpack_pack_str_with_body(&pk, RAID_KEY_ETAG, sizeof(RAID_KEY_ETAG) - 1);
+    msgpack_pack_str(&pk, RAID_ETAG_SIZE);
+    a->etag_offset = sbuf.size;
+    msgpack_pack_str_body(&pk, "________", RAID_ETAG_SIZE);
+    msgpack_pack_str_with_body(&pk, RAID_KEY_BODY, sizeof(RAID_KEY_BODY) - 1);
+
+    a->name = strdup(name);
+    a->envelope_len = sbuf.size;
+    a->envelope = msgpack_sbuffer_release(&sbuf);
+    return RAID_SUCCESS;
+}
+
+void raid_action_destroy(raid_action_t* a)
+{
+    free(a->name);
+    free(a->envelope);
+    memset(a, 0, sizeof(raid_action_t));
+}
+
+raid_action_t* raid_action_new(const char* name)
+{
+    raid_action_t* a = malloc(sizeof(raid_action_t));
+    if (raid_action_init(a, name) != RAID_SUCCESS) {
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+void raid_action_delete(raid_action_t* a)
+{
+    if (a == NULL) return;
+
+    raid_action_destroy(a);
+    free(a);
+}
+
 void raid_writer_init(raid_writer_t* w, raid_client_t* cl)
 {
     memset(w, 0, sizeof(raid_writer_t));
@@ -77,8 +266,15 @@ void raid_writer_init(raid_writer_t* w, raid_client_t* cl)
     msgpack_packer_init(&w->pk, &w->sbuf, msgpack_sbuffer_write);
 }
 
+void raid_writer_relocate(raid_writer_t* w)
+{
+    w->pk.data = &w->sbuf;
+}
+
 void raid_writer_destroy(raid_writer_t* w)
 {
+    writer_clear_refs(w);
+    raid_dealloc(w->refs, "writer.refs");
     if (w->etag) {
         free(w->etag);
     }
@@ -100,6 +296,76 @@ void raid_writer_delete(raid_writer_t* w)
     free(w);
 }
 
+raid_writer_t* raid_writer_acquire(raid_client_t* cl)
+{
+    pthread_mutex_lock(&cl->pool_mutex);
+    if (cl->writer_pool_len > 0) {
+        raid_writer_t* w = cl->writer_pool[--cl->writer_pool_len];
+        pthread_mutex_unlock(&cl->pool_mutex);
+        return w;
+    }
+    pthread_mutex_unlock(&cl->pool_mutex);
+
+    return raid_writer_new(cl);
+}
+
+void raid_writer_release(raid_writer_t* w)
+{
+    if (w == NULL) return;
+
+    raid_client_t* cl = w->cl;
+    if (w->sbuf.alloc <= RAID_WRITER_POOL_MAX_DATA) {
+        writer_clear_refs(w);
+        msgpack_sbuffer_clear(&w->sbuf);
+        if (w->etag) {
+            free(w->etag);
+            w->etag = NULL;
+        }
+
+        pthread_mutex_lock(&cl->pool_mutex);
+        if (cl->writer_pool == NULL) {
+            cl->writer_pool = raid_alloc(sizeof(raid_writer_t*) * RAID_WRITER_POOL_SIZE, "writer_pool");
+        }
+        if (cl->writer_pool != NULL && cl->writer_pool_len < RAID_WRITER_POOL_SIZE) {
+            cl->writer_pool[cl->writer_pool_len++] = w;
+            pthread_mutex_unlock(&cl->pool_mutex);
+            return;
+        }
+        pthread_mutex_unlock(&cl->pool_mutex);
+    }
+
+    raid_writer_delete(w);
+}
+
+void raid_writer_pool_clear(raid_client_t* cl)
+{
+    pthread_mutex_lock(&cl->pool_mutex);
+    for (size_t i = 0; i < cl->writer_pool_len; i++) {
+        raid_writer_delete(cl->writer_pool[i]);
+    }
+    raid_dealloc(cl->writer_pool, "writer_pool");
+    cl->writer_pool = NULL;
+    cl->writer_pool_len = 0;
+    pthread_mutex_unlock(&cl->pool_mutex);
+}
+
+raid_error_t raid_writer_reserve(raid_writer_t* w, size_t len)
+{
+    msgpack_sbuffer* sbuf = &w->sbuf;
+    if (sbuf->alloc - sbuf->size >= len) {
+        return RAID_SUCCESS;
+    }
+
+    char* data = realloc(sbuf->data, sbuf->size + len);
+    if (data == NULL) {
+        return RAID_UNKNOWN;
+    }
+
+    sbuf->data = data;
+    sbuf->alloc = sbuf->size + len;
+    return RAID_SUCCESS;
+}
+
 const char* raid_writer_etag(const raid_writer_t* w)
 {
     return w->etag;
@@ -115,6 +381,69 @@ size_t raid_writer_size(const raid_writer_t* w)
     return w->sbuf.size;
 }
 
+size_t raid_writer_wire_size(const raid_writer_t* w)
+{
+    return w->sbuf.size + w->refs_len;
+}
+
+raid_error_t raid_writer_flatten(raid_writer_t* w)
+{
+    if (w->num_refs == 0) return RAID_SUCCESS;
+
+    // Open a gap for each reference, from the end so the data before it stays in place.
+    size_t old_size = w->sbuf.size;
+    if (sbuffer_reserve(&w->sbuf, w->refs_len) == NULL) return RAID_UNKNOWN;
+
+    char* data = w->sbuf.data;
+    size_t src_end = old_size;
+    size_t dst_end = old_size + w->refs_len;
+    for (size_t i = w->num_refs; i > 0; i--) {
+        const raid_writer_ref_t* ref = &w->refs[i - 1];
+        size_t tail = src_end - ref->offset;
+        memmove(data + dst_end - tail, data + ref->offset, tail);
+        dst_end -= tail;
+        memcpy(data + dst_end - ref->len, ref->data, ref->len);
+        dst_end -= ref->len;
+        src_end = ref->offset;
+    }
+    w->sbuf.size = old_size + w->refs_len;
+
+    writer_clear_refs(w);
+    return RAID_SUCCESS;
+}
+
+size_t raid_writer_num_segments(const raid_writer_t* w)
+{
+    return w->num_refs * 2 + 1;
+}
+
+size_t raid_writer_segments(const raid_writer_t* w, raid_buf_t* bufs)
+{
+    size_t n = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i < w->num_refs; i++) {
+        const raid_writer_ref_t* ref = &w->refs[i];
+        if (ref->offset > offset) {
+            bufs[n].data = w->sbuf.data + offset;
+            bufs[n].len = ref->offset - offset;
+            bufs[n].zerocopy = false;
+            n++;
+        }
+        bufs[n].data = ref->data;
+        bufs[n].len = ref->len;
+        bufs[n].zerocopy = true;
+        n++;
+        offset = ref->offset;
+    }
+    if (w->sbuf.size > offset) {
+        bufs[n].data = w->sbuf.data + offset;
+        bufs[n].len = w->sbuf.size - offset;
+        bufs[n].zerocopy = false;
+        n++;
+    }
+    return n;
+}
+
 raid_error_t raid_write_message(raid_writer_t* w, const char* action)
 {
     return raid_write_message_ex(w, action, true);
@@ -125,6 +454,16 @@ raid_error_t raid_write_message_without_body(raid_writer_t* w, const char* actio
     return raid_write_message_ex(w, action, false);
 }
 
+raid_error_t raid_write_message_action(raid_writer_t* w, const raid_action_t* action)
+{
+    return raid_write_message_action_ex(w, action, true);
+}
+
+raid_error_t raid_write_message_action_without_body(raid_writer_t* w, const raid_action_t* action)
+{
+    return raid_write_message_action_ex(w, action, false);
+}
+
 raid_error_t raid_write_raw(raid_writer_t* w, const char* data, size_t data_len)
 {
     msgpack_sbuffer_write(&w->sbuf, data, data_len);
@@ -164,6 +503,44 @@ raid_error_t raid_write_float(raid_writer_t* w, double n)
     return RAID_SUCCESS;
 }
 
+raid_error_t raid_write_int_array(raid_writer_t* w, const int64_t* data, size_t n)
+{
+    msgpack_packer* pk = &w->pk;
+    msgpack_pack_array(pk, n);
+
+    // Encode straight into the buffer, 9 bytes is the widest integer encoding.
+    char* begin = sbuffer_reserve(&w->sbuf, n * 9);
+    if (begin == NULL) return RAID_UNKNOWN;
+
+    char* p = begin;
+    for (size_t i = 0; i < n; i++) {
+        p = pack_int64(p, data[i]);
+    }
+    w->sbuf.size += (size_t)(p - begin);
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_write_float_array(raid_writer_t* w, const double* data, size_t n)
+{
+    msgpack_packer* pk = &w->pk;
+    msgpack_pack_array(pk, n);
+
+    // Every element has the same size, as in msgpack_pack_float.
+    char* p = sbuffer_reserve(&w->sbuf, n * 5);
+    if (p == NULL) return RAID_UNKNOWN;
+
+    for (size_t i = 0; i < n; i++) {
+        float f = (float)data[i];
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        p[0] = (char)0xca;
+        store_be32(p + 1, bits);
+        p += 5;
+    }
+    w->sbuf.size += n * 5;
+    return RAID_SUCCESS;
+}
+
 raid_error_t raid_write_binary(raid_writer_t* w, const char* data, size_t len)
 {
     msgpack_packer* pk = &w->pk;
@@ -172,6 +549,38 @@ raid_error_t raid_write_binary(raid_writer_t* w, const char* data, size_t len)
     return RAID_SUCCESS;
 }
 
+raid_error_t raid_write_binary_ref(raid_writer_t* w, const char* data, size_t len, raid_release_callback_t release, void* user_data)
+{
+    if (len < RAID_WRITER_REF_MIN_SIZE) {
+        raid_error_t err = raid_write_binary(w, data, len);
+        if (release) {
+            release(data, len, user_data);
+        }
+        return err;
+    }
+
+    if (w->num_refs == w->refs_cap) {
+        size_t cap = w->refs_cap ? w->refs_cap * 2 : 4;
+        raid_writer_ref_t* refs = raid_realloc(w->refs, sizeof(raid_writer_ref_t) * cap, "writer.refs");
+        if (refs == NULL) return RAID_UNKNOWN;
+
+        w->refs = refs;
+        w->refs_cap = cap;
+    }
+
+    msgpack_packer* pk = &w->pk;
+    msgpack_pack_bin(pk, len);
+
+    raid_writer_ref_t* ref = &w->refs[w->num_refs++];
+    ref->offset = w->sbuf.size;
+    ref->data = data;
+    ref->len = len;
+    ref->release = release;
+    ref->user_data = user_data;
+    w->refs_len += len;
+    return RAID_SUCCESS;
+}
+
 raid_error_t raid_write_string(raid_writer_t* w, const char* str, size_t len)
 {
     msgpack_packer* pk = &w->pk;
@@ -370,3 +779,159 @@ raid_error_t raid_write_mapf(raid_writer_t* w, int n, const char* format, ...)
 
     return result;
 }
+
+static raid_error_t format_parse(raid_format_t* f, const char* format, msgpack_packer* pk, size_t* num_items)
+{
+    const char* fc = format;
+    size_t n = 0;
+    while (true) {
+        while (isspace(*fc)) { fc++; }
+        if (!*fc) break;
+
+        size_t prefix_start = ((msgpack_sbuffer*)pk->data)->size;
+        if (f->is_map) {
+            char delim = *fc++;
+            if (delim != '\'' && delim != '"') {
+                return RAID_INVALID_ARGUMENT;
+            }
+
+            const char* key = fc;
+            while (*fc && *fc != delim) { fc++; }
+            if (!*fc || fc == key || fc - key > 1024) {
+                return RAID_INVALID_ARGUMENT;
+            }
+
+            msgpack_pack_str_with_body(pk, key, (size_t)(fc - key));
+            fc++;
+            while (isspace(*fc)) { fc++; }
+        }
+
+        if ((*fc++) != '%') {
+            return RAID_INVALID_ARGUMENT;
+        }
+
+        char c = *fc++;
+        if (c != 'd' && c != 'f' && c != 's' && c != 'o') {
+            return RAID_INVALID_ARGUMENT;
+        }
+
+        if (f->items != NULL) {
+            f->items[n].type = c;
+            f->items[n].prefix_len = ((msgpack_sbuffer*)pk->data)->size - prefix_start;
+        }
+        n++;
+    }
+
+    *num_items = n;
+    return RAID_SUCCESS;
+}
+
+raid_error_t raid_format_init(raid_format_t* f, const char* format)
+{
+    memset(f, 0, sizeof(raid_format_t));
+    if (!format) return RAID_INVALID_ARGUMENT;
+
+    const char* fc = format;
+    while (isspace(*fc)) { fc++; }
+    f->is_map = (*fc != '%');
+
+    msgpack_sbuffer sbuf;
+    msgpack_packer pk;
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+    // Count the items first, then encode the keys for real.
+    size_t num_items = 0;
+    raid_error_t err = format_parse(f, format, &pk, &num_items);
+    if (err != RAID_SUCCESS || num_items == 0) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return RAID_INVALID_ARGUMENT;
+    }
+
+    f->items = raid_alloc(sizeof(raid_format_item_t) * num_items, "format.items");
+    f->num_items = num_items;
+    msgpack_sbuffer_clear(&sbuf);
+    if (f->is_map) {
+        msgpack_pack_map(&pk, num_items);
+    }
+    else {
+        msgpack_pack_array(&pk, num_items);
+    }
+    size_t header_len = sbuf.size;
+
+    format_parse(f, format, &pk, &num_items);
+    f->items[0].prefix_len += header_len;
+
+    f->prefix_len = sbuf.size;
+    f->prefix = msgpack_sbuffer_release(&sbuf);
+    return RAID_SUCCESS;
+}
+
+void raid_format_destroy(raid_format_t* f)
+{
+    raid_dealloc(f->items, "format.items");
+    free(f->prefix);
+    memset(f, 0, sizeof(raid_format_t));
+}
+
+raid_format_t* raid_format_compile(const char* format)
+{
+    raid_format_t* f = malloc(sizeof(raid_format_t));
+    if (raid_format_init(f, format) != RAID_SUCCESS) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void raid_format_delete(raid_format_t* f)
+{
+    if (f == NULL) return;
+
+    raid_format_destroy(f);
+    free(f);
+}
+
+raid_error_t raid_write_format(raid_writer_t* w, const raid_format_t* f, ...)
+{
+    if (!f || !f->items) return RAID_INVALID_ARGUMENT;
+
+    msgpack_packer* pk = &w->pk;
+    const char* prefix = f->prefix;
+
+    va_list args;
+    va_start(args, f);
+    for (size_t i = 0; i < f->num_items; i++) {
+        const raid_format_item_t* item = &f->items[i];
+        if (item->prefix_len > 0) {
+            msgpack_sbuffer_write(&w->sbuf, prefix, item->prefix_len);
+            prefix += item->prefix_len;
+        }
+
+        switch (item->type) {
+        case 'd': {
+            int64_t int_arg = va_arg(args, int64_t);
+            msgpack_pack_int64(pk, int_arg);
+            break;
+        }
+        case 'f': {
+            double float_arg = va_arg(args, double);
+            msgpack_pack_float(pk, float_arg);
+            break;
+        }
+        case 's': {
+            const char* str_arg = va_arg(args, char*);
+            msgpack_pack_str_with_body(pk, str_arg, strlen(str_arg));
+            break;
+        }
+        case 'o': {
+            const msgpack_object* obj_arg = va_arg(args, msgpack_object*);
+            msgpack_pack_object(pk, *obj_arg);
+            break;
+        }
+        }
+    }
+    va_end(args);
+
+    return RAID_SUCCESS;
+}
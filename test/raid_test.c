@@ -2,6 +2,13 @@
 #include <raid.h>
 #include <raid_internal.h>
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
 #define TEST_ASSERT(cond, message) \
     if (!(cond)) { fprintf(stderr, "Assertion failed: \"%s\" - %s\n", #cond, message); return 1; }
 
@@ -209,6 +216,444 @@ bool test_read_garbage(raid_client_t* raid)
     return false;
 }
 
+bool test_read_views(raid_client_t* raid)
+{
+    const char* text = "TEXT";
+
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_array(&w, 3);
+    raid_write_string(&w, text, strlen(text));
+    raid_write_binary(&w, "\x01\x02\x03", 3);
+    raid_write_mapf(&w, 1, "'key' %d", (int64_t)1);
+
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, w.sbuf.data, w.sbuf.size);
+
+    size_t size = 0;
+    const char* ptr = NULL;
+    size_t len = 0;
+    TEST_ASSERT(raid_read_begin_array(&r, &size), "should be able to read array size");
+
+    TEST_ASSERT(raid_read_string_view(&r, &ptr, &len), "should be able to view string");
+    TEST_ASSERT(len == strlen(text) && !memcmp(ptr, text, len), "Array[0] should be 'TEXT'");
+    TEST_ASSERT(ptr >= r.src_data && ptr < r.src_data + r.src_data_len, "view should point into the reader's buffer");
+    raid_read_next(&r);
+
+    TEST_ASSERT(raid_read_binary_view(&r, &ptr, &len), "should be able to view binary");
+    TEST_ASSERT(len == 3 && ptr[2] == 3, "Array[1] should be {1, 2, 3}");
+    raid_read_next(&r);
+
+    TEST_ASSERT(raid_read_begin_map(&r, &size), "should be able to read map size");
+    TEST_ASSERT(raid_read_map_key_view(&r, &ptr, &len), "should be able to view map key");
+    TEST_ASSERT(len == 3 && !memcmp(ptr, "key", len), "map key should be 'key'");
+    raid_read_end_map(&r);
+
+    raid_read_end_array(&r);
+    TEST_ASSERT(!raid_read_etag_view(&r, &ptr, &len), "non-response data should not have an etag");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_read_map_get(raid_client_t* raid)
+{
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+
+    // {"k0": 0, ..., "k31": 31, "items": [{"id": 10}, {"id": 11}]}
+    raid_write_map(&w, 33);
+    for (int i = 0; i < 32; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        raid_write_cstring(&w, key);
+        raid_write_int(&w, i);
+    }
+    raid_write_cstring(&w, "items");
+    raid_write_array(&w, 2);
+    raid_write_mapf(&w, 1, "'id' %d", (int64_t)10);
+    raid_write_mapf(&w, 1, "'id' %d", (int64_t)11);
+
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, w.sbuf.data, w.sbuf.size);
+
+    for (int i = 31; i >= 0; i--) {
+        char key[8];
+        int64_t val = -1;
+        snprintf(key, sizeof(key), "k%d", i);
+        TEST_ASSERT(raid_read_map_get(&r, key), "should find the key");
+        TEST_ASSERT(raid_read_int(&r, &val) && val == i, "value should match the key");
+        raid_read_end_map(&r);
+    }
+    TEST_ASSERT(!raid_read_map_get(&r, "k"), "should not find a missing key");
+    TEST_ASSERT(raid_is_map(&r), "should stay on the map after a failed lookup");
+
+    int64_t id = 0;
+    TEST_ASSERT(raid_read_path(&r, "items.1.id"), "should follow the path");
+    TEST_ASSERT(raid_read_int(&r, &id) && id == 11, "items.1.id should be 11");
+    raid_read_end_path(&r, "items.1.id");
+    TEST_ASSERT(raid_is_map(&r), "should be back on the map");
+
+    TEST_ASSERT(!raid_read_path(&r, "items.2.id"), "should not follow an out of bounds index");
+    TEST_ASSERT(raid_is_map(&r), "should stay on the map after a failed path");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_read_map_index_cache(raid_client_t* raid)
+{
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+
+    // [{"k0": 0, ..., "k19": 19 + n}, ...], every map is big enough to be indexed.
+    const int num_maps = 50;
+    raid_write_array(&w, num_maps);
+    for (int n = 0; n < num_maps; n++) {
+        raid_write_map(&w, 20);
+        for (int i = 0; i < 20; i++) {
+            char key[8];
+            snprintf(key, sizeof(key), "k%d", i);
+            raid_write_cstring(&w, key);
+            raid_write_int(&w, i + n);
+        }
+    }
+
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, w.sbuf.data, w.sbuf.size);
+
+    // Twice over, so the second pass finds the evicted indices recycled.
+    for (int pass = 0; pass < 2; pass++) {
+        size_t len = 0;
+        TEST_ASSERT(raid_read_begin_array(&r, &len) && len == (size_t)num_maps, "should read the array");
+        for (int n = 0; n < num_maps; n++) {
+            int64_t val = -1;
+            TEST_ASSERT(raid_read_map_get(&r, "k7"), "should find the key");
+            TEST_ASSERT(raid_read_int(&r, &val) && val == 7 + n, "value should match the map");
+            raid_read_end_map(&r);
+            TEST_ASSERT(!raid_read_map_get(&r, "k20"), "should not find a missing key");
+            raid_read_next(&r);
+        }
+        raid_read_end_array(&r);
+    }
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_write_read_arrays(raid_client_t* raid)
+{
+    const int64_t ints[] = { 0, 1, -1, 127, 128, -32, -33, -128, -129, 255, 256, 65535, 65536,
+                             -32768, -32769, 4294967295LL, 4294967296LL, -2147483648LL, -2147483649LL,
+                             INT64_MAX, INT64_MIN };
+    const double floats[] = { 0.0, 1.5, -2.25, 1e10 };
+    const size_t num_ints = sizeof(ints) / sizeof(ints[0]);
+    const size_t num_floats = sizeof(floats) / sizeof(floats[0]);
+
+    raid_writer_t w, expected;
+    raid_writer_init(&w, raid);
+    raid_writer_init(&expected, raid);
+
+    raid_write_array(&w, 2);
+    raid_write_int_array(&w, ints, num_ints);
+    raid_write_float_array(&w, floats, num_floats);
+
+    raid_write_array(&expected, 2);
+    raid_write_array(&expected, num_ints);
+    for (size_t i = 0; i < num_ints; i++) {
+        raid_write_int(&expected, ints[i]);
+    }
+    raid_write_array(&expected, num_floats);
+    for (size_t i = 0; i < num_floats; i++) {
+        raid_write_float(&expected, floats[i]);
+    }
+
+    TEST_ASSERT(w.sbuf.size == expected.sbuf.size, "array encoding size should match");
+    TEST_ASSERT(!memcmp(w.sbuf.data, expected.sbuf.data, w.sbuf.size), "array encoding should match");
+
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, w.sbuf.data, w.sbuf.size);
+
+    size_t size = 0;
+    int64_t int_out[32];
+    double float_out[32];
+    TEST_ASSERT(raid_read_begin_array(&r, &size), "should be able to read array size");
+    TEST_ASSERT(!raid_read_float_array(&r, float_out, 32, &size), "should not read ints as floats");
+    TEST_ASSERT(raid_read_int_array(&r, int_out, 32, &size), "should be able to read int array");
+    TEST_ASSERT(size == num_ints && !memcmp(int_out, ints, sizeof(ints)), "int array should match");
+    raid_read_next(&r);
+    TEST_ASSERT(raid_read_float_array(&r, float_out, 2, &size), "should be able to read float array");
+    TEST_ASSERT(size == num_floats && float_out[1] == 1.5, "float array should match");
+    raid_read_end_array(&r);
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&expected);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_reader_reset_and_pool(raid_client_t* raid)
+{
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_cstring(&w, "pooled");
+
+    raid_reader_t r;
+    raid_reader_init_pooled(raid, &r);
+    raid_reader_set_data(&r, w.sbuf.data, w.sbuf.size, false);
+    TEST_ASSERT(raid_is_string(&r), "should read a string");
+
+    raid_reader_reset(&r);
+    TEST_ASSERT(raid_is_invalid(&r), "reset reader should not have a value");
+    TEST_ASSERT(r.src_data_cap >= w.sbuf.size, "reset reader should keep its buffer");
+
+    char* data = r.src_data;
+    raid_reader_destroy_pooled(raid, &r);
+
+    raid_reader_t r2;
+    raid_reader_init_pooled(raid, &r2);
+    TEST_ASSERT(r2.src_data == data, "should reuse the pooled reader");
+    TEST_ASSERT(raid_is_invalid(&r2), "pooled reader should not have a value");
+    raid_reader_set_data(&r2, w.sbuf.data, w.sbuf.size, false);
+    TEST_ASSERT(r2.src_data == data, "should reuse the pooled buffer");
+    TEST_ASSERT(raid_is_string(&r2), "should read a string");
+    raid_reader_destroy_pooled(raid, &r2);
+
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_writer_pool(raid_client_t* raid)
+{
+    raid_writer_t* w = raid_writer_acquire(raid);
+    TEST_ASSERT(w != NULL, "should get a writer");
+    TEST_ASSERT(raid_writer_reserve(w, 100000) == RAID_SUCCESS, "should reserve memory");
+    TEST_ASSERT(w->sbuf.alloc >= 100000, "should have reserved capacity");
+
+    char* data = w->sbuf.data;
+    for (int i = 0; i < 10000; i++) {
+        raid_write_int(w, 1000000);
+    }
+    TEST_ASSERT(w->sbuf.data == data, "should not grow a reserved buffer");
+    raid_writer_release(w);
+
+    raid_writer_t* w2 = raid_writer_acquire(raid);
+    TEST_ASSERT(w2 == w, "should reuse the pooled writer");
+    TEST_ASSERT(raid_writer_size(w2) == 0 && raid_writer_etag(w2) == NULL, "pooled writer should be empty");
+    TEST_ASSERT(w2->sbuf.data == data, "pooled writer should keep its buffer");
+    raid_writer_release(w2);
+    return false;
+}
+
+bool test_write_format(raid_client_t* raid)
+{
+    raid_writer_t w, expected;
+    raid_writer_init(&w, raid);
+    raid_writer_init(&expected, raid);
+
+    raid_format_t* map_format = raid_format_compile("'number' %d \"name\" %s 'ratio' %f");
+    raid_format_t* array_format = raid_format_compile("%d %s");
+    TEST_ASSERT(map_format != NULL && map_format->is_map, "should compile a map format");
+    TEST_ASSERT(array_format != NULL && !array_format->is_map, "should compile an array format");
+    TEST_ASSERT(raid_format_compile("'key' %x") == NULL, "should not compile an invalid format");
+
+    for (int i = 0; i < 2; i++) {
+        raid_write_format(&w, map_format, (int64_t)1234, "Hello world", 0.5);
+        raid_write_format(&w, array_format, (int64_t)-1, "TEXT");
+
+        raid_write_mapf(&expected, 3, "'number' %d \"name\" %s 'ratio' %f", (int64_t)1234, "Hello world", 0.5);
+        raid_write_arrayf(&expected, 2, "%d %s", (int64_t)-1, "TEXT");
+    }
+
+    TEST_ASSERT(w.sbuf.size == expected.sbuf.size, "format encoding size should match");
+    TEST_ASSERT(!memcmp(w.sbuf.data, expected.sbuf.data, w.sbuf.size), "format encoding should match");
+
+    raid_format_delete(map_format);
+    raid_format_delete(array_format);
+    raid_writer_destroy(&expected);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_write_message_action(raid_client_t* raid)
+{
+    raid_writer_t w, expected;
+    raid_writer_init(&w, raid);
+    raid_writer_init(&expected, raid);
+
+    raid_action_t* action = raid_action_new("hcs.exam.get");
+    TEST_ASSERT(action != NULL, "should create an action");
+
+    for (int i = 0; i < 2; i++) {
+        bool with_body = (i == 0);
+        if (with_body) {
+            raid_write_message_action(&w, action);
+            raid_write_message(&expected, "hcs.exam.get");
+        }
+        else {
+            raid_write_message_action_without_body(&w, action);
+            raid_write_message_without_body(&expected, "hcs.exam.get");
+        }
+
+        const char* etag = raid_writer_etag(&w);
+        TEST_ASSERT(etag != NULL && strlen(etag) == 8, "should have an etag");
+        TEST_ASSERT(w.sbuf.size == expected.sbuf.size, "envelope size should match");
+
+        // Same bytes as raid_write_message once the etags are swapped.
+        memcpy(expected.sbuf.data + action->etag_offset, etag, 8);
+        TEST_ASSERT(!memcmp(w.sbuf.data, expected.sbuf.data, w.sbuf.size), "envelope should match");
+
+        raid_reader_t r;
+        raid_reader_init(&r);
+        raid_write_nil(&w);
+        raid_reader_set_data(&r, w.sbuf.data, w.sbuf.size, true);
+        const char* read_etag = NULL;
+        size_t len = 0;
+        TEST_ASSERT(raid_read_etag_view(&r, &read_etag, &len), "should read the etag back");
+        TEST_ASSERT(len == 8 && !memcmp(read_etag, etag, len), "etag should match");
+        TEST_ASSERT(with_body == raid_is_nil(&r), "only messages with body should have one");
+        raid_reader_destroy(&r);
+    }
+
+    raid_action_delete(action);
+    raid_writer_destroy(&expected);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+static void count_release_callback(const char* data, size_t len, void* ud)
+{
+    (void)data;
+    (void)len;
+    (*(int*)ud)++;
+}
+
+bool test_write_binary_ref(raid_client_t* raid)
+{
+    size_t big_len = 64*1024;
+    char* big = malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) {
+        big[i] = (char)i;
+    }
+
+    raid_writer_t w, expected;
+    raid_writer_init(&w, raid);
+    raid_writer_init(&expected, raid);
+
+    int released = 0;
+    raid_write_array(&w, 4);
+    raid_write_binary_ref(&w, big, big_len, count_release_callback, &released);
+    raid_write_int(&w, 42);
+    raid_write_binary_ref(&w, "small", 5, count_release_callback, &released);
+    raid_write_binary_ref(&w, big, big_len, count_release_callback, &released);
+
+    raid_write_array(&expected, 4);
+    raid_write_binary(&expected, big, big_len);
+    raid_write_int(&expected, 42);
+    raid_write_binary(&expected, "small", 5);
+    raid_write_binary(&expected, big, big_len);
+
+    TEST_ASSERT(released == 1, "small data should be copied and released right away");
+    TEST_ASSERT(w.num_refs == 2, "big data should be referenced");
+    TEST_ASSERT(raid_writer_wire_size(&w) == raid_writer_size(&expected), "wire size should count the references");
+    TEST_ASSERT(raid_writer_size(&w) == w.sbuf.size, "size should match the writer's data");
+    TEST_ASSERT(w.sbuf.size < 100, "referenced data should not be copied");
+
+    TEST_ASSERT(raid_writer_flatten(&w) == RAID_SUCCESS, "should flatten the writer");
+    TEST_ASSERT(released == 3, "flattening should release the references");
+    TEST_ASSERT(w.sbuf.size == expected.sbuf.size, "flattened size should match");
+    TEST_ASSERT(!memcmp(w.sbuf.data, expected.sbuf.data, w.sbuf.size), "flattened data should match");
+
+    raid_writer_destroy(&expected);
+    raid_writer_destroy(&w);
+    free(big);
+    return false;
+}
+
+bool test_request_binary_ref(raid_client_t* raid)
+{
+    size_t big_len = 1024*1024;
+    char* big = malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) {
+        big[i] = (char)(i * 7);
+    }
+
+    int released = 0;
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_message(&w, "echo");
+    raid_write_binary_ref(&w, big, big_len, count_release_callback, &released);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    raid_error_t err;
+    TEST_CALL(err, raid_request(raid, &w, &r));
+
+    const char* data = NULL;
+    size_t len = 0;
+    TEST_ASSERT(raid_read_binary_view(&r, &data, &len), "response should be binary");
+    TEST_ASSERT(len == big_len && !memcmp(data, big, len), "response should echo the data");
+
+    raid_writer_destroy(&w);
+    TEST_ASSERT(released == 1, "destroying the writer should release the reference");
+
+    raid_reader_destroy(&r);
+    free(big);
+    return false;
+}
+
+bool test_request_zerocopy(raid_client_t* raid)
+{
+    size_t big_len = 4*1024*1024;
+    char* big = malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) {
+        big[i] = (char)(i * 13);
+    }
+
+    raid_set_zerocopy_threshold(raid, 64*1024);
+
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_message(&w, "echo");
+    raid_write_binary_ref(&w, big, big_len, NULL, NULL);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    raid_error_t err;
+    TEST_CALL(err, raid_request(raid, &w, &r));
+    raid_writer_destroy(&w);
+
+    const char* data = NULL;
+    size_t len = 0;
+    TEST_ASSERT(raid_read_binary_view(&r, &data, &len), "response should be binary");
+    TEST_ASSERT(len == big_len && !memcmp(data, big, len), "response should echo the data");
+
+    // The server got everything, the completions follow without another send.
+    int64_t deadline = raid_clock_ms() + 5000;
+    while (raid_zerocopy_pending(raid) > 0 && raid_clock_ms() < deadline) {
+        usleep(1000);
+    }
+    TEST_ASSERT(raid_zerocopy_pending(raid) == 0, "the kernel should release the pages");
+
+    // The writer's own buffer is copied, it can go away right after the send.
+    raid_writer_init(&w, raid);
+    raid_write_message(&w, "echo");
+    raid_write_binary(&w, big, big_len);
+    TEST_CALL(err, raid_request(raid, &w, &r));
+    raid_writer_destroy(&w);
+    TEST_ASSERT(raid_zerocopy_pending(raid) == 0, "only references should be sent zero-copy");
+    TEST_ASSERT(raid_read_binary_view(&r, &data, &len), "response should be binary");
+    TEST_ASSERT(len == big_len && !memcmp(data, big, len), "response should echo the data");
+
+    raid_set_zerocopy_threshold(raid, 0);
+    raid_reader_destroy(&r);
+    free(big);
+    return false;
+}
+
 bool test_request_group(raid_client_t* raid)
 {
     raid_request_group_t* group = raid_request_group_new(raid);
@@ -245,82 +690,1034 @@ bool test_request_group(raid_client_t* raid)
     return false;
 }
 
-bool test_request_group_with_error(raid_client_t* raid)
+bool test_request_group_large(raid_client_t* raid)
 {
+    const int num_entries = 1000;
     raid_request_group_t* group = raid_request_group_new(raid);
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < num_entries; i++) {
         raid_request_group_entry_t* entry = raid_request_group_add(group);
-        raid_write_message(&entry->writer, "hcs.exam.get");
-
-        const char* uid = "";
-        const char* key = NULL;
-        if (i == 0) {
-            key = "physician";
-        }
-        else {
-            key = "patient";
-        }
-        raid_write_mapf(&entry->writer, 2, "'_' %s 'k' %s", uid, key);
+        raid_write_message(&entry->writer, "echo");
+        raid_write_int(&entry->writer, i);
     }
 
-    TEST_ASSERT(raid_request_group_send_and_wait(group) == RAID_NOT_CONNECTED, "Should not be connected");
-
+    raid_error_t err;
+    TEST_CALL(err, raid_request_group_send_and_wait(group));
     TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
 
+    raid_reader_t* r = raid_reader_new();
+    raid_request_group_read_to_array(group, r, NULL);
+
+    size_t arr_size = 0;
+    TEST_ASSERT(raid_read_begin_array(r, &arr_size), "Should read an array");
+    TEST_ASSERT(arr_size == (size_t)num_entries, "Should read all the responses");
+    int64_t sum = 0;
+    for (size_t i = 0; i < arr_size; i++) {
+        int64_t n = 0;
+        raid_read_int(r, &n);
+        sum += n;
+        raid_read_next(r);
+    }
+    raid_read_end_array(r);
+    TEST_ASSERT(sum == (int64_t)num_entries * (num_entries - 1) / 2, "Should echo every request");
+
+    raid_reader_delete(r);
     raid_request_group_delete(group);
 
     return false;
 }
 
-static void cancel_request_callback(raid_client_t* cl, raid_reader_t* r, raid_error_t err, void* ud)
+bool test_request_group_ready(raid_client_t* raid)
 {
-    TEST_ASSERT(err == RAID_CANCELED, "Error code should be RAID_CANCELED");
+    raid_request_group_t* group = raid_request_group_new(raid);
+    for (int i = 0; i < 3; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        // The server never answers "drop".
+        raid_write_message(&entry->writer, i == 0 ? "drop" : "echo");
+        raid_write_int(&entry->writer, i);
+    }
+
+    raid_error_t err;
+    TEST_CALL(err, raid_request_group_send(group));
+
+    TEST_ASSERT(raid_request_group_wait_quorum(group, 2, raid_clock_ms() + 5000), "Should get 2 responses");
+    TEST_ASSERT(!raid_request_group_wait_until(group, raid_clock_ms() + 100), "Should time out waiting for all");
+
+    // The pending request points at its entry, which must not move.
+    raid_request_group_entry_t* first = &group->entries[0];
+    TEST_ASSERT(raid_request_group_add(group) == NULL, "Should not add while requests are pending");
+    TEST_ASSERT(!raid_request_group_reserve(group, 64), "Should not grow while requests are pending");
+    TEST_ASSERT(group->num_entries == 3 && &group->entries[0] == first, "Should keep the entries in place");
+    TEST_ASSERT(raid_request_group_send(group) == RAID_INVALID_ARGUMENT, "Should not send again while requests are pending");
+    TEST_ASSERT(group->num_entries_done == 2 && group->num_entries_sent == 3, "Should keep the state of the first send");
+
+    raid_request_group_entry_t* entry = raid_request_group_wait_any(group);
+    TEST_ASSERT(entry == &group->entries[1], "Should get the first response");
+    entry = raid_request_group_next_ready(group);
+    TEST_ASSERT(entry == &group->entries[2], "Should get the second response");
+    TEST_ASSERT(raid_request_group_next_ready(group) == NULL, "Should not have more responses");
+
+    raid_cancel_request(raid, group->entries[0].writer.etag);
+    entry = raid_request_group_wait_any(group);
+    TEST_ASSERT(entry == &group->entries[0], "Should get the canceled request");
+    TEST_ASSERT(entry->error == RAID_CANCELED, "Should be canceled");
+    TEST_ASSERT(raid_request_group_wait_any(group) == NULL, "Should have returned every entry");
+
+    TEST_ASSERT(raid_request_group_add(group) != NULL, "Should add once every request is done");
+    TEST_ASSERT(raid_request_group_reserve(group, 64), "Should grow once every request is done");
+
+    raid_request_group_delete(group);
+    return false;
 }
 
-bool test_cancel_request(raid_client_t* raid)
+bool test_request_group_cancel(raid_client_t* raid)
 {
-    raid_writer_t w;
-    raid_writer_init(&w, raid);
-    raid_write_message(&w, "hcs.operator.announce");
-    raid_write_mapf(&w, 2,"'_' %s 'name' %s", "ASDFGHJK", "operator name");
+    raid_request_group_t* group = raid_request_group_new(raid);
+    for (int i = 0; i < 50; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        raid_write_message_without_body(&entry->writer, "drop");
+    }
 
     raid_error_t err;
-    TEST_CALL(err, raid_request_async(raid, &w, cancel_request_callback, NULL));
+    TEST_CALL(err, raid_request_group_send(group));
+    TEST_ASSERT(raid_num_requests(raid) == 50, "Should have pending requests");
 
-    raid_cancel_request(raid, raid_writer_etag(&w));
+    raid_request_group_cancel(group);
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+    TEST_ASSERT(raid_request_group_wait_until(group, raid_clock_ms()), "Every entry should be done");
+    for (size_t i = 0; i < group->num_entries; i++) {
+        TEST_ASSERT(group->entries[i].error == RAID_CANCELED, "Should be canceled");
+        TEST_ASSERT(group->entries[i].request == NULL, "Should not point to a request");
+    }
+    raid_request_group_delete(group);
 
+    // Deleting a group cancels its pending requests too.
+    group = raid_request_group_new(raid);
+    raid_write_message_without_body(&raid_request_group_add(group)->writer, "drop");
+    TEST_CALL(err, raid_request_group_send(group));
+    raid_request_group_delete(group);
     TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
 
-    raid_writer_destroy(&w);
+    return false;
 }
 
-bool test_writer_etag(raid_client_t* raid)
+bool test_request_group_cancel_in_flight(raid_client_t* raid)
 {
-    raid_writer_t w;
-    raid_writer_init(&w, raid);
-    raid_write_message(&w, "hcs.operator.announce");
-    raid_write_mapf(&w, 2,"'_' %s 'name' %s", "ASDFGHJK", "operator name");
+    // Cancel while the responses are arriving, every entry must finish exactly once.
+    for (int round = 0; round < 20; round++) {
+        raid_request_group_t* group = raid_request_group_new(raid);
+        for (int i = 0; i < 64; i++) {
+            raid_request_group_entry_t* entry = raid_request_group_add(group);
+            raid_write_message(&entry->writer, "echo");
+            raid_write_int(&entry->writer, i);
+        }
 
-    TEST_ASSERT(raid_writer_etag(&w) != NULL, "Should have an etag");
+        raid_error_t err;
+        TEST_CALL(err, raid_request_group_send(group));
+        if (round % 2) {
+            usleep(200);
+        }
+        raid_request_group_cancel(group);
+        TEST_ASSERT(raid_request_group_wait_until(group, raid_clock_ms() + 5000), "Should finish the group");
+        TEST_ASSERT(group->num_entries_done == group->num_entries, "Should finish every entry once");
+        for (size_t i = 0; i < group->num_entries; i++) {
+            raid_error_t e = group->entries[i].error;
+            TEST_ASSERT(e == RAID_SUCCESS || e == RAID_CANCELED, "Should be answered or canceled");
+        }
+        raid_request_group_delete(group);
+    }
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+    return false;
+}
 
-    raid_writer_destroy(&w);
+bool test_request_group_deadline(raid_client_t* raid)
+{
+    raid_request_group_t* group = raid_request_group_new(raid);
+    for (int i = 0; i < 6; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        raid_write_message_without_body(&entry->writer, i == 0 ? "echo" : "drop");
+    }
+
+    int64_t start = raid_clock_ms();
+    raid_request_group_set_deadline(group, start + 300);
+
+    raid_error_t err;
+    TEST_CALL(err, raid_request_group_send_and_wait(group));
+    TEST_ASSERT(raid_clock_ms() - start < 2000, "Should return by the deadline");
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+    TEST_ASSERT(group->entries[0].error == RAID_SUCCESS, "Should get the response");
+    for (size_t i = 1; i < group->num_entries; i++) {
+        TEST_ASSERT(group->entries[i].error == RAID_RECV_TIMEOUT, "Should time out");
+    }
+
+    raid_request_group_delete(group);
+    return false;
 }
 
-static void before_send_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+static void deadline_request_callback(raid_client_t* cl, raid_reader_t* r, raid_error_t err, void* ud)
 {
-    raid_reader_t r;
-    raid_reader_init_with_data(&r, data, data_len);
-    fprintf(stdout, "send: ");
-    msgpack_object_print(stdout, *r.obj);
-    fprintf(stdout, "\n");
-    raid_reader_destroy(&r);
+    (void)cl;
+    (void)r;
+    *(raid_error_t*)ud = err;
 }
 
-static void after_recv_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+bool test_request_deadline(raid_client_t* raid)
 {
-    raid_reader_t r;
-    raid_reader_init_with_data(&r, data, data_len);
-    fprintf(stdout, "recv: ");
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_message_without_body(&w, "drop");
+
+    raid_error_t result = RAID_UNKNOWN;
+    raid_error_t err;
+    TEST_CALL(err, raid_request_async_until(raid, &w, raid_clock_ms() + 50, deadline_request_callback, &result));
+    TEST_ASSERT(raid_num_requests(raid) == 1, "Should have a pending request");
+
+    // The next response received after the deadline expires the request.
+    struct timespec ts = { 0, 100*1000000 };
+    nanosleep(&ts, NULL);
+    raid_reader_t r;
+    raid_reader_init(&r);
+    raid_write_message_without_body(&w, "echo");
+    TEST_CALL(err, raid_request(raid, &w, &r));
+
+    TEST_ASSERT(result == RAID_RECV_TIMEOUT, "Should time out");
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+static void count_reconnect_callback(raid_client_t* cl, void* ud)
+{
+    (void)cl;
+    (*(int*)ud)++;
+}
+
+bool test_auto_reconnect(raid_client_t* raid)
+{
+    int reconnects = 0;
+    unsigned int connection_id = raid_connection_id(raid);
+    raid_add_reconnect_callback(raid, count_reconnect_callback, &reconnects);
+    raid_set_auto_reconnect(raid, true, 10, 100);
+    raid_register_idempotent_action(raid, "echo");
+
+    // The server closes the connection on "close", before reading the "echo".
+    raid_request_group_t* group = raid_request_group_new(raid);
+    raid_write_message_without_body(&raid_request_group_add(group)->writer, "close");
+    raid_request_group_entry_t* entry = raid_request_group_add(group);
+    raid_write_message(&entry->writer, "echo");
+    raid_write_int(&entry->writer, 7);
+
+    raid_error_t err;
+    TEST_CALL(err, raid_request_group_send(group));
+    TEST_ASSERT(raid_request_group_wait_until(group, raid_clock_ms() + 5000), "Should finish the group");
+
+    entry = &group->entries[1];
+    int64_t n = 0;
+    TEST_ASSERT(group->entries[0].error == RAID_NOT_CONNECTED, "Should fail the non-idempotent request");
+    TEST_ASSERT(entry->error == RAID_SUCCESS, "Should replay the idempotent request");
+    TEST_ASSERT(raid_read_int(&entry->reader, &n) && n == 7, "Should get the replayed response");
+    TEST_ASSERT(reconnects == 1, "Should call the reconnect callback");
+    TEST_ASSERT(raid_connection_id(raid) == connection_id + 1, "Should be a new connection");
+    TEST_ASSERT(raid_connected(raid), "Should be connected");
+
+    raid_set_auto_reconnect(raid, false, 0, 0);
+    raid_request_group_delete(group);
+    return false;
+}
+
+bool test_replay_keeps_timeout(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    raid_init(&cl, RAID_HOST, RAID_PORT);
+    raid_error_t err;
+    TEST_CALL(err, raid_connect(&cl));
+    raid_set_auto_reconnect(&cl, true, 10, 50);
+    raid_set_request_timeout(&cl, 1);
+    raid_register_idempotent_action(&cl, "drop");
+
+    // Never answered, but replayed on every reconnect.
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message_without_body(&w, "drop");
+    raid_error_t result = RAID_UNKNOWN;
+    TEST_CALL(err, raid_request_async(&cl, &w, deadline_request_callback, &result));
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    int64_t deadline = raid_clock_ms() + 8000;
+    while (result == RAID_UNKNOWN && raid_clock_ms() < deadline) {
+        // Reconnect faster than the timeout, then keep some data flowing.
+        raid_write_message_without_body(&w, "close");
+        raid_request(&cl, &w, &r);
+        usleep(200*1000);
+        raid_write_message_without_body(&w, "echo");
+        raid_request(&cl, &w, &r);
+    }
+    TEST_ASSERT(result == RAID_RECV_TIMEOUT, "Should time out despite the replays");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_destroy(&cl);
+    return false;
+}
+
+bool test_connect_timeout(raid_client_t* raid)
+{
+    (void)raid;
+
+    // Not routable, the connect either fails right away or times out.
+    raid_client_t cl;
+    raid_init(&cl, "10.255.255.1", "31110");
+    raid_set_connect_timeout(&cl, 200);
+
+    int64_t start = raid_clock_ms();
+    TEST_ASSERT(raid_connect(&cl) == RAID_CONNECT_ERROR, "Should not connect");
+    TEST_ASSERT(raid_clock_ms() - start < 2000, "Should give up by the timeout");
+    TEST_ASSERT(!raid_connected(&cl), "Should not be connected");
+
+    raid_destroy(&cl);
+    return false;
+}
+
+bool test_connect_fallback(raid_client_t* raid)
+{
+    (void)raid;
+
+    // localhost might resolve to ::1 first, which the server doesn't listen on.
+    raid_client_t cl;
+    raid_init(&cl, "localhost", RAID_PORT);
+
+    raid_error_t err;
+    TEST_CALL(err, raid_connect(&cl));
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_int(&w, 3);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    int64_t n = 0;
+    TEST_ASSERT(raid_read_int(&r, &n) && n == 3, "Should get the response");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_disconnect(&cl);
+    raid_destroy(&cl);
+    return false;
+}
+
+bool test_frame_limits(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    raid_init(&cl, RAID_HOST, RAID_PORT);
+    raid_error_t err;
+    TEST_CALL(err, raid_connect(&cl));
+
+    // Bigger than the initial receive buffer, so it has to grow.
+    size_t str_len = 300 * 1024;
+    char* str = malloc(str_len);
+    for (size_t i = 0; i < str_len; i++) {
+        str[i] = 'a' + (char)(i % 26);
+    }
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_string(&w, str, str_len);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    const char* res;
+    size_t res_len;
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    TEST_ASSERT(raid_read_string_view(&r, &res, &res_len) && res_len == str_len && !memcmp(res, str, str_len), "Should grow to the whole frame");
+    TEST_ASSERT(cl.msg_buf && cl.msg_buf_cap >= str_len, "Should keep the receive buffer for the next frame");
+
+    raid_set_spill_threshold(&cl, 1024);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    TEST_ASSERT(raid_read_string_view(&r, &res, &res_len) && res_len == str_len && !memcmp(res, str, str_len), "Should load the spilled frame");
+#ifndef _WIN32
+    TEST_ASSERT(r.src_data_mapped, "Should decode the spilled frame from the mapping");
+#endif
+    raid_set_spill_threshold(&cl, 0);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    TEST_ASSERT(!r.src_data_mapped, "Should release the mapping with the next response");
+    TEST_ASSERT(raid_read_string_view(&r, &res, &res_len) && res_len == str_len && !memcmp(res, str, str_len), "Should grow to the whole frame");
+
+    // The response is over the limit, the connection can't be trusted anymore.
+    raid_set_max_frame_size(&cl, 1024);
+    TEST_ASSERT(raid_request(&cl, &w, &r) != RAID_SUCCESS, "Should reject the frame");
+    TEST_ASSERT(!raid_connected(&cl), "Should drop the connection");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_destroy(&cl);
+    free(str);
+    return false;
+}
+
+bool test_connect_addresses(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_error_t err;
+    raid_address_t* addrs = NULL;
+    size_t num_addrs = 0;
+    TEST_CALL(err, raid_resolve_cached(RAID_HOST, RAID_PORT, &addrs, &num_addrs));
+    TEST_ASSERT(num_addrs > 0, "Should resolve the host");
+
+    raid_address_t* cached = NULL;
+    size_t num_cached = 0;
+    TEST_CALL(err, raid_resolve_cached(RAID_HOST, RAID_PORT, &cached, &num_cached));
+    TEST_ASSERT(num_cached == num_addrs && !memcmp(cached, addrs, num_addrs * sizeof(raid_address_t)), "Should reuse the cached addresses");
+    free(cached);
+
+    // The host can't resolve, only the pre-resolved addresses get it connected.
+    raid_client_t cl;
+    raid_init(&cl, "raid.invalid", RAID_PORT);
+    TEST_CALL(err, raid_set_addresses(&cl, addrs, num_addrs));
+    free(addrs);
+    TEST_CALL(err, raid_connect(&cl));
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_int(&w, 5);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    int64_t n = 0;
+    TEST_ASSERT(raid_read_int(&r, &n) && n == 5, "Should get the response");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_disconnect(&cl);
+
+    TEST_CALL(err, raid_set_addresses(&cl, NULL, 0));
+    TEST_ASSERT(raid_connect(&cl) == RAID_INVALID_ADDRESS, "Should resolve the host again");
+
+    raid_destroy(&cl);
+    raid_clear_address_cache();
+    return false;
+}
+
+bool test_socket_options(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_socket_options_t opts;
+    raid_socket_options_init(&opts);
+    TEST_ASSERT(opts.nodelay && opts.keepalive, "Should default to low latency");
+    opts.recv_timeout_ms = 500;
+    opts.recv_buffer_size = 256*1024;
+    opts.keepalive_idle_secs = 5;
+
+    raid_client_t cl;
+    raid_error_t err;
+    TEST_CALL(err, raid_init_ex(&cl, RAID_HOST, RAID_PORT, &opts));
+    TEST_CALL(err, raid_connect(&cl));
+
+#ifndef _WIN32
+    int value = 0;
+    socklen_t value_len = sizeof(value);
+    getsockopt(cl.socket.handle, IPPROTO_TCP, TCP_NODELAY, &value, &value_len);
+    TEST_ASSERT(value, "Should disable Nagle's algorithm");
+    getsockopt(cl.socket.handle, SOL_SOCKET, SO_KEEPALIVE, &value, &value_len);
+    TEST_ASSERT(value, "Should enable keepalive");
+#ifdef TCP_KEEPIDLE
+    getsockopt(cl.socket.handle, IPPROTO_TCP, TCP_KEEPIDLE, &value, &value_len);
+    TEST_ASSERT(value == 5, "Should set the keepalive idle time");
+#endif
+    struct timeval tv = { 0 };
+    socklen_t tv_len = sizeof(tv);
+    getsockopt(cl.socket.handle, SOL_SOCKET, SO_RCVTIMEO, &tv, &tv_len);
+    TEST_ASSERT(tv.tv_sec == 0 && tv.tv_usec == 500*1000, "Should set the recv timeout");
+#endif
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_int(&w, 7);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    int64_t n = 0;
+    TEST_ASSERT(raid_read_int(&r, &n) && n == 7, "Should get the response");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_disconnect(&cl);
+    raid_destroy(&cl);
+    return false;
+}
+
+#ifdef RAID_UNIX_PATH
+bool test_unix_socket(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    raid_error_t err;
+    TEST_CALL(err, raid_init(&cl, "unix:" RAID_UNIX_PATH, NULL));
+    TEST_CALL(err, raid_connect(&cl));
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_int(&w, 9);
+
+    raid_reader_t r;
+    raid_reader_init(&r);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    int64_t n = 0;
+    TEST_ASSERT(raid_read_int(&r, &n) && n == 9, "Should get the response");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    raid_disconnect(&cl);
+    raid_destroy(&cl);
+    return false;
+}
+#endif
+
+bool test_unix_address(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    TEST_ASSERT(raid_init(&cl, "localhost", NULL) == RAID_INVALID_ARGUMENT, "Should need a port for TCP");
+
+    raid_error_t err;
+    TEST_CALL(err, raid_init(&cl, "unix:/nonexistent/raid.sock", NULL));
+#ifdef _WIN32
+    TEST_ASSERT(raid_connect(&cl) == RAID_INVALID_ADDRESS, "Should not support unix sockets");
+#else
+    TEST_ASSERT(raid_connect(&cl) == RAID_CONNECT_ERROR, "Should not find the socket");
+#endif
+    raid_destroy(&cl);
+
+    char long_path[256] = "unix:/";
+    memset(long_path + 6, 'a', sizeof(long_path) - 7);
+    long_path[sizeof(long_path) - 1] = 0;
+    TEST_CALL(err, raid_init(&cl, long_path, NULL));
+    TEST_ASSERT(raid_connect(&cl) == RAID_INVALID_ADDRESS, "Should not fit in a socket address");
+    raid_destroy(&cl);
+    return false;
+}
+
+#ifdef __linux__
+typedef struct {
+    int listen_handle;
+    raid_socket_t s;
+} shm_peer_t;
+
+// Stand-in for a co-located server, sends every message back once it's complete.
+static void* shm_echo_peer(void* arg)
+{
+    shm_peer_t* peer = (shm_peer_t*)arg;
+    raid_socket_t* s = &peer->s;
+    if (raid_shm_accept(peer->listen_handle, s) != RAID_SUCCESS) {
+        return NULL;
+    }
+
+    size_t cap = 4096;
+    size_t len = 0;
+    char* msg = malloc(cap);
+    while (true) {
+        if (cap - len < 4096) {
+            cap *= 2;
+            msg = realloc(msg, cap);
+        }
+        int n = 0;
+        if (raid_socket_recv(s, msg + len, cap - len, &n) == RAID_NOT_CONNECTED) {
+            break;
+        }
+        len += (size_t)n;
+
+        size_t msg_len = 0;
+        while (len >= 4 && len >= (msg_len = 4 + (((size_t)(unsigned char)msg[0] << 24) |
+            ((size_t)(unsigned char)msg[1] << 16) | ((size_t)(unsigned char)msg[2] << 8) | (unsigned char)msg[3]))) {
+            raid_socket_send(s, msg, msg_len);
+            memmove(msg, msg + msg_len, len - msg_len);
+            len -= msg_len;
+        }
+    }
+    free(msg);
+    raid_socket_close(s);
+    return NULL;
+}
+
+bool test_shm_transport(raid_client_t* raid)
+{
+    (void)raid;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/raid_test_%ld.sock", (long)raid_clock_ms());
+    char host[80];
+    snprintf(host, sizeof(host), "shm:%s", path);
+
+    raid_error_t err;
+    shm_peer_t peer;
+    memset(&peer, 0, sizeof(peer));
+    raid_socket_options_init(&peer.s.opts);
+    peer.s.handle = -1;
+    TEST_CALL(err, raid_shm_listen(path, &peer.listen_handle));
+
+    raid_client_t cl;
+    TEST_CALL(err, raid_init(&cl, host, NULL));
+
+    // The client waits for the peer's answer, so accept on another thread.
+    pthread_t peer_thread;
+    pthread_create(&peer_thread, NULL, &shm_echo_peer, &peer);
+    TEST_CALL(err, raid_connect(&cl));
+
+    // Larger than a ring, so both sides have to wait for room.
+    const size_t big_len = 3*1024*1024 + 17;
+    char* big = malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) {
+        big[i] = (char)(i * 7);
+    }
+
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_reader_t r;
+    raid_reader_init(&r);
+    for (int i = 0; i < 100; i++) {
+        raid_write_message(&w, "echo");
+        raid_write_int(&w, i);
+        TEST_CALL(err, raid_request(&cl, &w, &r));
+        int64_t n = -1;
+        TEST_ASSERT(raid_read_int(&r, &n) && n == i, "Should get the response");
+    }
+
+    raid_write_message(&w, "echo");
+    raid_write_binary(&w, big, big_len);
+    TEST_CALL(err, raid_request(&cl, &w, &r));
+    const char* data = NULL;
+    size_t data_len = 0;
+    TEST_ASSERT(raid_read_binary_view(&r, &data, &data_len), "Should get the data back");
+    TEST_ASSERT(data_len == big_len && !memcmp(data, big, big_len), "Should not corrupt the data");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    free(big);
+
+    // The peer notices and leaves.
+    raid_disconnect(&cl);
+    pthread_join(peer_thread, NULL);
+    TEST_ASSERT(!raid_socket_connected(&peer.s), "Peer should be disconnected");
+
+    raid_destroy(&cl);
+    close(peer.listen_handle);
+    unlink(path);
+    return false;
+}
+
+static void* shm_accept_peer(void* arg)
+{
+    shm_peer_t* peer = (shm_peer_t*)arg;
+    raid_shm_accept(peer->listen_handle, &peer->s);
+    return NULL;
+}
+
+bool test_shm_stalled_peer(raid_client_t* raid)
+{
+    (void)raid;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/raid_test_%ld.sock", (long)raid_clock_ms());
+    char host[80];
+    snprintf(host, sizeof(host), "shm:%s", path);
+
+    raid_error_t err;
+    shm_peer_t peer;
+    memset(&peer, 0, sizeof(peer));
+    raid_socket_options_init(&peer.s.opts);
+    peer.s.handle = -1;
+    TEST_CALL(err, raid_shm_listen(path, &peer.listen_handle));
+
+    raid_socket_options_t opts;
+    raid_socket_options_init(&opts);
+    opts.recv_timeout_ms = 200;
+    raid_client_t cl;
+    TEST_CALL(err, raid_init_ex(&cl, host, NULL, &opts));
+
+    // The peer sets up the rings and then never reads from them.
+    pthread_t peer_thread;
+    pthread_create(&peer_thread, NULL, &shm_accept_peer, &peer);
+    TEST_CALL(err, raid_connect(&cl));
+    pthread_join(peer_thread, NULL);
+
+    const size_t big_len = 2*1024*1024;
+    char* big = calloc(1, big_len);
+    raid_writer_t w;
+    raid_writer_init(&w, &cl);
+    raid_write_message(&w, "echo");
+    raid_write_binary(&w, big, big_len);
+    int64_t start_ms = raid_clock_ms();
+    TEST_ASSERT(raid_request_async(&cl, &w, NULL, NULL) != RAID_SUCCESS, "Should not fit in the ring");
+    TEST_ASSERT(raid_clock_ms() - start_ms < 2000, "Should give up after the recv timeout");
+    raid_writer_destroy(&w);
+    free(big);
+
+    // Stop the client from setting up the connection again.
+    close(peer.listen_handle);
+    unlink(path);
+    raid_disconnect(&cl);
+    raid_socket_close(&peer.s);
+    raid_destroy(&cl);
+    return false;
+}
+#endif
+
+static void count_recv_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+{
+    (void)cl;
+    (void)data;
+    (void)data_len;
+    ATOMIC_ADD(*(unsigned int*)ud, 1);
+}
+
+// Removes itself the first time it's called.
+static void remove_self_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+{
+    count_recv_callback(cl, data, data_len, ud);
+    raid_remove_after_recv_callback(cl, remove_self_callback, ud);
+}
+
+bool test_callbacks_remove(raid_client_t* raid)
+{
+    unsigned int count = 0;
+    unsigned int self_count = 0;
+    raid_add_after_recv_callback(raid, count_recv_callback, &count);
+    raid_add_after_recv_callback(raid, remove_self_callback, &self_count);
+
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_reader_t r;
+    raid_reader_init(&r);
+    raid_error_t err;
+    for (int i = 0; i < 3; i++) {
+        raid_write_message(&w, "echo");
+        raid_write_int(&w, i);
+        TEST_CALL(err, raid_request(raid, &w, &r));
+    }
+    TEST_ASSERT(ATOMIC_READ(count) == 3, "Should be called for every message");
+    TEST_ASSERT(ATOMIC_READ(self_count) == 1, "Should be able to remove itself");
+
+    TEST_ASSERT(raid_remove_after_recv_callback(raid, count_recv_callback, &count), "Should find the callback");
+    TEST_CALL(err, raid_request(raid, &w, &r));
+    TEST_ASSERT(ATOMIC_READ(count) == 3, "Should not be called once removed");
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+static void count_msg_callback(raid_client_t* cl, raid_reader_t* r, void* ud)
+{
+    (void)cl;
+    (void)r;
+    ATOMIC_ADD(*(unsigned int*)ud, 1);
+}
+
+static void pushed_msg_callback(raid_client_t* cl, raid_reader_t* r, void* ud)
+{
+    const char* action;
+    size_t action_len;
+    if (raid_read_action_view(r, &action, &action_len) &&
+        action_len == strlen("pushed") && !memcmp(action, "pushed", action_len)) {
+        count_msg_callback(cl, r, ud);
+    }
+}
+
+bool test_subscribe(raid_client_t* raid)
+{
+    unsigned int pushed = 0;
+    unsigned int other = 0;
+    unsigned int all = 0;
+    char actions[40][16];
+    for (int i = 0; i < 40; i++) {
+        snprintf(actions[i], sizeof(actions[i]), "other.%d", i);
+        TEST_ASSERT(raid_subscribe(raid, actions[i], count_msg_callback, &other) == RAID_SUCCESS, "Should subscribe");
+    }
+    TEST_ASSERT(raid_subscribe(raid, "pushed", pushed_msg_callback, &pushed) == RAID_SUCCESS, "Should subscribe");
+    raid_add_msg_recv_callback(raid, count_msg_callback, &all);
+
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_reader_t r;
+    raid_reader_init(&r);
+    raid_error_t err;
+
+    // The server pushes a message before echoing the request.
+    raid_write_message(&w, "push");
+    raid_write_int(&w, 1);
+    TEST_CALL(err, raid_request(raid, &w, &r));
+    TEST_ASSERT(ATOMIC_READ(pushed) == 1, "Should route the push to its subscriber");
+    TEST_ASSERT(ATOMIC_READ(other) == 0, "Should not route the push to other actions");
+    TEST_ASSERT(ATOMIC_READ(all) == 1, "Should still reach the msg_recv callbacks");
+
+    TEST_ASSERT(raid_unsubscribe(raid, "pushed", pushed_msg_callback, &pushed), "Should find the subscription");
+    TEST_ASSERT(!raid_unsubscribe(raid, "pushed", pushed_msg_callback, &pushed), "Should be removed already");
+    TEST_CALL(err, raid_request(raid, &w, &r));
+    TEST_ASSERT(ATOMIC_READ(pushed) == 1, "Should not be called once unsubscribed");
+    TEST_ASSERT(ATOMIC_READ(all) == 2, "Should still reach the msg_recv callbacks");
+
+    for (int i = 0; i < 40; i++) {
+        TEST_ASSERT(raid_unsubscribe(raid, actions[i], count_msg_callback, &other), "Should find the subscription");
+    }
+    raid_remove_msg_recv_callback(raid, count_msg_callback, &all);
+
+    raid_reader_destroy(&r);
+    raid_writer_destroy(&w);
+    return false;
+}
+
+bool test_subscription_table(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    raid_init(&cl, "localhost", "31110");
+    unsigned int a = 0, b = 0;
+    TEST_ASSERT(raid_subscribe(&cl, NULL, count_msg_callback, &a) == RAID_INVALID_ARGUMENT, "Should need an action");
+
+    char action[16];
+    for (int i = 0; i < 10; i++) {
+        snprintf(action, sizeof(action), "action.%d", i);
+        raid_subscribe(&cl, action, count_msg_callback, &a);
+    }
+    raid_subscribe(&cl, "action.3", count_msg_callback, &b);
+
+    raid_subscription_table_t* table = cl.subscriptions;
+    TEST_ASSERT(table->num_subscriptions == 11, "Should keep every subscription");
+    TEST_ASSERT(table->num_buckets >= 11 && !(table->num_buckets & (table->num_buckets - 1)), "Should grow the buckets");
+    TEST_ASSERT(table->buckets[table->num_buckets] == 11, "Should cover every subscription with the buckets");
+
+    // Both subscriptions to the same action land in the same bucket, in order.
+    size_t found = 0;
+    for (size_t bucket = 0; bucket < table->num_buckets; bucket++) {
+        for (size_t i = table->buckets[bucket]; i < table->buckets[bucket + 1]; i++) {
+            raid_subscription_t* sub = &table->subscriptions[i];
+            TEST_ASSERT((sub->hash & (table->num_buckets - 1)) == bucket, "Should be in its bucket");
+            if (!strcmp(sub->action, "action.3")) {
+                TEST_ASSERT(sub->user_data == (found ? (void*)&b : (void*)&a), "Should keep the order");
+                found++;
+            }
+        }
+    }
+    TEST_ASSERT(found == 2, "Should find both subscriptions");
+
+    TEST_ASSERT(!raid_unsubscribe(&cl, "action.3", count_msg_callback, &found), "Should match the user data");
+    TEST_ASSERT(!raid_unsubscribe(&cl, "action.30", count_msg_callback, &a), "Should match the action");
+    TEST_ASSERT(raid_unsubscribe(&cl, "action.3", count_msg_callback, &b), "Should remove the subscription");
+    TEST_ASSERT(cl.subscriptions->num_subscriptions == 10, "Should keep the others");
+    for (int i = 0; i < 10; i++) {
+        snprintf(action, sizeof(action), "action.%d", i);
+        TEST_ASSERT(raid_unsubscribe(&cl, action, count_msg_callback, &a), "Should remove the subscription");
+    }
+    TEST_ASSERT(!cl.subscriptions, "Should drop the empty table");
+
+    raid_destroy(&cl);
+    return false;
+}
+
+bool test_callback_lists(raid_client_t* raid)
+{
+    (void)raid;
+
+    raid_client_t cl;
+    raid_init(&cl, "localhost", "31110");
+    int a = 0, b = 0;
+    TEST_ASSERT(!cl.callbacks[RAID_CALLBACK_BEFORE_SEND], "Should start without callbacks");
+
+    raid_add_before_send_callback(&cl, count_recv_callback, &a);
+    raid_add_before_send_callback(&cl, count_recv_callback, &b);
+    raid_add_msg_recv_callback(&cl, NULL, &a);
+    TEST_ASSERT(cl.callbacks[RAID_CALLBACK_BEFORE_SEND]->num_callbacks == 2, "Should keep callbacks by type");
+    TEST_ASSERT(cl.callbacks[RAID_CALLBACK_MSG_RECV]->num_callbacks == 1, "Should keep callbacks by type");
+    TEST_ASSERT(!cl.callbacks[RAID_CALLBACK_AFTER_RECV], "Should keep callbacks by type");
+
+    TEST_ASSERT(!raid_remove_after_recv_callback(&cl, count_recv_callback, &a), "Should only remove from its type");
+    TEST_ASSERT(raid_remove_before_send_callback(&cl, count_recv_callback, &a), "Should remove by user data");
+    TEST_ASSERT(!raid_remove_before_send_callback(&cl, count_recv_callback, &a), "Should be removed already");
+    TEST_ASSERT(cl.callbacks[RAID_CALLBACK_BEFORE_SEND]->num_callbacks == 1 &&
+        cl.callbacks[RAID_CALLBACK_BEFORE_SEND]->callbacks[0].user_data == &b, "Should keep the others");
+    TEST_ASSERT(raid_remove_before_send_callback(&cl, count_recv_callback, &b), "Should remove by user data");
+    TEST_ASSERT(!cl.callbacks[RAID_CALLBACK_BEFORE_SEND], "Should drop the empty list");
+
+    raid_destroy(&cl);
+    return false;
+}
+
+bool test_request_group_with_error(raid_client_t* raid)
+{
+    raid_request_group_t* group = raid_request_group_new(raid);
+    for (int i = 0; i < 2; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        raid_write_message(&entry->writer, "hcs.exam.get");
+
+        const char* uid = "";
+        const char* key = NULL;
+        if (i == 0) {
+            key = "physician";
+        }
+        else {
+            key = "patient";
+        }
+        raid_write_mapf(&entry->writer, 2, "'_' %s 'k' %s", uid, key);
+    }
+
+    TEST_ASSERT(raid_request_group_send_and_wait(group) == RAID_NOT_CONNECTED, "Should not be connected");
+
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+
+    raid_request_group_delete(group);
+
+    return false;
+}
+
+static void cancel_request_callback(raid_client_t* cl, raid_reader_t* r, raid_error_t err, void* ud)
+{
+    TEST_ASSERT(err == RAID_CANCELED, "Error code should be RAID_CANCELED");
+}
+
+bool test_cancel_request(raid_client_t* raid)
+{
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_message(&w, "hcs.operator.announce");
+    raid_write_mapf(&w, 2,"'_' %s 'name' %s", "ASDFGHJK", "operator name");
+
+    raid_error_t err;
+    TEST_CALL(err, raid_request_async(raid, &w, cancel_request_callback, NULL));
+
+    raid_cancel_request(raid, raid_writer_etag(&w));
+
+    TEST_ASSERT(raid_num_requests(raid) == 0, "Should not have any pending requests");
+
+    raid_writer_destroy(&w);
+}
+
+bool test_request_group_entries(raid_client_t* raid)
+{
+    raid_request_group_t* group = raid_request_group_new_with_capacity(raid, 2);
+    TEST_ASSERT(group->entries_cap == 2, "Should reserve the capacity");
+
+    for (int i = 0; i < 20; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        TEST_ASSERT(entry != NULL, "Should add an entry");
+        raid_write_array(&entry->writer, 2);
+        raid_write_int(&entry->writer, i);
+    }
+    TEST_ASSERT(group->num_entries == 20, "Should have 20 entries");
+
+    // Writers must keep working after the entries were moved.
+    for (int i = 0; i < 20; i++) {
+        raid_writer_t* w = &group->entries[i].writer;
+        raid_write_int(w, i * 2);
+
+        raid_reader_t r;
+        raid_reader_init_with_data(&r, raid_writer_data(w), raid_writer_size(w));
+        int64_t vals[2] = { 0 };
+        size_t len = 0;
+        TEST_ASSERT(raid_read_int_array(&r, vals, 2, &len), "Should read the entry");
+        TEST_ASSERT(len == 2 && vals[0] == i && vals[1] == i * 2, "Entry should keep its data");
+        raid_reader_destroy(&r);
+    }
+
+    raid_request_group_delete(group);
+    return false;
+}
+
+bool test_request_group_array_view(raid_client_t* raid)
+{
+    raid_request_group_t* group = raid_request_group_new(raid);
+    for (int i = 0; i < 4; i++) {
+        raid_request_group_entry_t* entry = raid_request_group_add(group);
+        if (i == 2) continue; // no response
+
+        raid_writer_t w;
+        raid_writer_init(&w, raid);
+        raid_write_mapf(&w, 1, "'n' %d", (int64_t)i);
+        raid_reader_set_data(&entry->reader, raid_writer_data(&w), raid_writer_size(&w), false);
+        raid_writer_destroy(&w);
+        entry->error = i == 2 ? RAID_CANCELED : RAID_SUCCESS;
+    }
+
+    raid_reader_t view, copy;
+    raid_reader_init(&view);
+    raid_reader_init(&copy);
+    raid_error_t* errs = NULL;
+    raid_request_group_read_to_array_view(group, &view, &errs);
+    raid_request_group_read_to_array(group, &copy, NULL);
+
+    raid_reader_t* readers[2] = { &view, &copy };
+    for (int k = 0; k < 2; k++) {
+        raid_reader_t* r = readers[k];
+        size_t size = 0;
+        TEST_ASSERT(raid_read_begin_array(r, &size), "Should read an array");
+        TEST_ASSERT(size == 4, "Should have every entry");
+        for (size_t i = 0; i < size; i++) {
+            if (i == 2) {
+                TEST_ASSERT(raid_is_nil(r), "Entry without response should be nil");
+            }
+            else {
+                int64_t n = -1;
+                TEST_ASSERT(raid_read_map_get(r, "n"), "Should find the key");
+                TEST_ASSERT(raid_read_int(r, &n) && n == (int64_t)i, "Should read the entry");
+                raid_read_end_map(r);
+            }
+            raid_read_next(r);
+        }
+        raid_read_end_array(r);
+    }
+    TEST_ASSERT(errs != NULL && errs[0] == RAID_SUCCESS, "Should return the errors");
+
+    free(errs);
+    raid_reader_destroy(&copy);
+    raid_reader_destroy(&view);
+    raid_request_group_delete(group);
+    return false;
+}
+
+bool test_writer_etag(raid_client_t* raid)
+{
+    raid_writer_t w;
+    raid_writer_init(&w, raid);
+    raid_write_message(&w, "hcs.operator.announce");
+    raid_write_mapf(&w, 2,"'_' %s 'name' %s", "ASDFGHJK", "operator name");
+
+    TEST_ASSERT(raid_writer_etag(&w) != NULL, "Should have an etag");
+
+    raid_writer_destroy(&w);
+}
+
+static void before_send_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+{
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, data, data_len);
+    fprintf(stdout, "send: ");
+    msgpack_object_print(stdout, *r.obj);
+    fprintf(stdout, "\n");
+    raid_reader_destroy(&r);
+}
+
+static void after_recv_callback(raid_client_t* cl, const char* data, size_t data_len, void* ud)
+{
+    raid_reader_t r;
+    raid_reader_init_with_data(&r, data, data_len);
+    fprintf(stdout, "recv: ");
     msgpack_object_print(stdout, *r.obj);
     fprintf(stdout, "\n");
     raid_reader_destroy(&r);
@@ -343,12 +1740,50 @@ int main(int argc, char** argv)
     raid_add_after_recv_callback(&raid, after_recv_callback, NULL);
 
     TEST_RUN(&raid, test_request_group);
+    TEST_RUN(&raid, test_request_group_large);
+    TEST_RUN(&raid, test_request_group_ready);
+    TEST_RUN(&raid, test_request_group_cancel);
+    TEST_RUN(&raid, test_request_group_cancel_in_flight);
+    TEST_RUN(&raid, test_request_group_deadline);
+    TEST_RUN(&raid, test_request_deadline);
     TEST_RUN(&raid, test_cancel_request);
+    TEST_RUN(&raid, test_request_binary_ref);
+    TEST_RUN(&raid, test_request_zerocopy);
+    TEST_RUN(&raid, test_auto_reconnect);
+    TEST_RUN(&raid, test_replay_keeps_timeout);
+    TEST_RUN(&raid, test_connect_fallback);
+    TEST_RUN(&raid, test_connect_addresses);
+    TEST_RUN(&raid, test_frame_limits);
+    TEST_RUN(&raid, test_socket_options);
+    TEST_RUN(&raid, test_callbacks_remove);
+    TEST_RUN(&raid, test_subscribe);
+#ifdef RAID_UNIX_PATH
+    TEST_RUN(&raid, test_unix_socket);
+#endif
 #endif
 
     TEST_RUN(&raid, test_write_msgpack);
     TEST_RUN(&raid, test_write_read);
     TEST_RUN(&raid, test_read_garbage);
+    TEST_RUN(&raid, test_read_views);
+    TEST_RUN(&raid, test_read_map_get);
+    TEST_RUN(&raid, test_read_map_index_cache);
+    TEST_RUN(&raid, test_write_read_arrays);
+    TEST_RUN(&raid, test_reader_reset_and_pool);
+    TEST_RUN(&raid, test_writer_pool);
+    TEST_RUN(&raid, test_write_format);
+    TEST_RUN(&raid, test_write_message_action);
+    TEST_RUN(&raid, test_write_binary_ref);
+    TEST_RUN(&raid, test_request_group_entries);
+    TEST_RUN(&raid, test_request_group_array_view);
+    TEST_RUN(&raid, test_connect_timeout);
+    TEST_RUN(&raid, test_unix_address);
+    TEST_RUN(&raid, test_callback_lists);
+    TEST_RUN(&raid, test_subscription_table);
+#ifdef __linux__
+    TEST_RUN(&raid, test_shm_transport);
+    TEST_RUN(&raid, test_shm_stalled_peer);
+#endif
     TEST_RUN(&raid, test_writer_etag);
 
     raid_disconnect(&raid);